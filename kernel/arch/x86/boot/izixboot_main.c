@@ -9,12 +9,17 @@
 #include <tty/tty_chardev_driver.h>
 #include <tty/tty_vga_text.h>
 #include <kprint/kprint.h>
+#include <kpanic/kpanic.h>
 #include <asm/toggle_int.h>
 #include <mm/malloc.h>
+#include <mm/kmalloc.h>
 #include <mm/freemem.h>
+#include <mm/memblock.h>
 #include <mm/gdt.h>
 #include <mm/e820.h>
 #include <mm/paging.h>
+#include <mm/fault.h>
+#include <mm/vmalloc.h>
 #include <sched/tss.h>
 #include <sched/kthread.h>
 #include <int/idt.h>
@@ -27,9 +32,8 @@
 #include <time/clock.h>
 #include <time/clock_tick.h>
 
-#define KERNEL_START      ((void *)0x8000)
-#define KERNEL_MAX_LENGTH (127 * (size_t)512)
-#define KERNEL_MAX_END    (KERNEL_START + KERNEL_MAX_LENGTH)
+// From the linker script.
+extern char __kernel_start[], __gnu_bssend[];
 
 #if !defined(IZIX)
 #define AMERICAN_DATE
@@ -74,43 +78,34 @@ void kernel_main (
 	void *e820_entries_3x = (void *)e820_entries_3x_u32;
 #pragma GCC diagnostic pop
 
-	const size_t kernel_and_bss_length =
-		((bss_end > KERNEL_MAX_END) ?
-			(size_t)(bss_end - KERNEL_START)
-			: KERNEL_MAX_LENGTH);
-
-	freemem_region_t
-		kernel_region, null_region, stack_region,
-		int_stack_region, freemem_internal_region,
-		tty_chardev_driver_region;
-
-	// TODO: Get the actually start and length of the kernel by parsing its own ELF at
-	// runtime or by createing all the nessesary symbols in the linker script.
-	kernel_region = new_freemem_region (
-		KERNEL_START,
-		kernel_and_bss_length);
-	null_region = new_freemem_region (
-		NULL,
-		MALLOC_ALIGNMENT);
-	stack_region = new_freemem_region (
-		stack_start + MALLOC_ALIGNMENT,
-		stack_length - MALLOC_ALIGNMENT);
-	int_stack_region = new_freemem_region (
-		freemem_region_end (kernel_region), // Exclusive max.
-		KTHREAD_STACK_SIZE);
-	freemem_internal_region = new_freemem_region (
-		freemem_region_end (int_stack_region), // Exclusive max.
-		9 * PAGE_SIZE);
-	tty_chardev_driver_region = new_freemem_region (
-		freemem_region_end (freemem_internal_region), // Exclusive max.
-		sizeof(tty_chardev_driver_t));
-
-	if (tty_chardev_driver_region.length % MALLOC_ALIGNMENT)
-		tty_chardev_driver_region.length +=
-			MALLOC_ALIGNMENT - sizeof(tty_chardev_driver_t) % MALLOC_ALIGNMENT;
-
-	volatile tty_chardev_driver_t *tty_chardev_driver_vga_text =
-		tty_chardev_driver_region.p;
+	const freemem_region_t
+		kernel_region = new_freemem_region (
+			__kernel_start,
+			(size_t)(__gnu_bssend - __kernel_start)),
+		null_region = new_freemem_region (
+			NULL,
+			MALLOC_ALIGNMENT),
+		stack_region = new_freemem_region (
+			stack_start + MALLOC_ALIGNMENT,
+			stack_length - MALLOC_ALIGNMENT);
+
+	// Everything boot needs before freemem comes from memblock.
+	e820_3x_register (e820_entry_count, e820_entries_3x);
+	e820_3x_add_memblock ();
+
+	memblock_reserve (null_region);
+	memblock_reserve (stack_region);
+	memblock_reserve (kernel_region);
+	e820_3x_clone ();
+
+	volatile tty_chardev_driver_t *tty_chardev_driver_vga_text = memblock_alloc (
+		sizeof(tty_chardev_driver_t), MALLOC_ALIGNMENT);
+	void *int_stack = memblock_alloc (KTHREAD_STACK_SIZE, MALLOC_ALIGNMENT);
+	// freemem starts with one page, and grows by itself after that.
+	void *freemem_internal = memblock_alloc (PAGE_SIZE, PAGE_SIZE);
+	if (!tty_chardev_driver_vga_text || !int_stack || !freemem_internal)
+		kpanic ();
+
 	*tty_chardev_driver_vga_text = new_tty_vga_driver ();
 	tty_chardev_driver_vga_text->init (
 		(tty_chardev_driver_t *)tty_chardev_driver_vga_text);
@@ -129,18 +124,10 @@ void kernel_main (
 		e820_entry_count,
 		e820_entries_3x);
 
-	freemem_init (freemem_internal_region.p, freemem_internal_region.length);
-
-	e820_3x_register (e820_entry_count, e820_entries_3x);
 	e820_3x_print ();
-	e820_3x_add_freemem ();
 
-	freemem_remove_region (tty_chardev_driver_region);
-	freemem_remove_region (freemem_internal_region);
-	freemem_remove_region (int_stack_region);
-	freemem_remove_region (kernel_region);
-	freemem_remove_region (stack_region);
-	freemem_remove_region (null_region);
+	freemem_init (freemem_internal, PAGE_SIZE);
+	memblock_release ();
 
 	idt_init ();
 
@@ -176,9 +163,9 @@ void kernel_main (
 	// Hooks need to be added to IRQ hook lists before the IDT is loaded.
 	clock_tick_start ();
 
-	tss_init (freemem_region_end (int_stack_region));
+	tss_init (int_stack + KTHREAD_STACK_SIZE);
 	// TSS must be initialized before tss_get () does any good.
-	gdt_init (tss_get ());
+	gdt_init (tss_get (), tss_get_fault ());
 	tss_load (GDT_SUPERVISOR_TSS_SELECTOR);
 
 	paging_data_t paging_data_base;
@@ -193,8 +180,11 @@ void kernel_main (
 	dev_map_all (&paging_data_base);
 
 	paging_enable (&paging_data_base);
+	fault_init ();
+	vmalloc_init ();
 
 	kthread_init (stack_region);
+	kmalloc_init ();
 
 	kprintf (
 		"boot/izixboot_main: Early boot took aprox. %lld ms.\n",
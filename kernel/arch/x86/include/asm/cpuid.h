@@ -0,0 +1,66 @@
+// kernel/arch/x86/include/asm/cpuid.h
+
+#ifndef IZIX_ASM_CPUID_H
+#define IZIX_ASM_CPUID_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CPUID_EFLAGS_ID 0x200000
+
+#define CPUID_LEAF_VENDOR   0x0
+#define CPUID_LEAF_FEATURES 0x1
+
+#define CPUID_FEATURE_EDX_PSE (1 << 3)
+#define CPUID_FEATURE_EDX_PGE (1 << 13)
+
+typedef struct cpuid_regs_struct {
+	uint32_t eax;
+	uint32_t ebx;
+	uint32_t ecx;
+	uint32_t edx;
+} cpuid_regs_t;
+
+// cpuid is present if the ID flag of eflags can be toggled.
+static inline bool cpuid_is_supported () {
+	uint32_t original, toggled;
+	asm volatile (
+		"		pushf;\n"
+		"		pop		%0;\n"
+		"		mov		%0,				%1;\n"
+		"		xor		%2,				%1;\n"
+		"		push	%1;\n"
+		"		popf;\n"
+		"		pushf;\n"
+		"		pop		%1;\n"
+		"		push	%0;\n"
+		"		popf;\n"
+		:"=&r"(original), "=&r"(toggled)
+		:"i"(CPUID_EFLAGS_ID)
+		:"cc");
+
+	return (original ^ toggled) & CPUID_EFLAGS_ID;
+}
+
+static inline cpuid_regs_t cpuid (uint32_t leaf) {
+	cpuid_regs_t regs;
+	asm volatile (
+		"		cpuid;\n"
+		:"=a"(regs.eax), "=b"(regs.ebx), "=c"(regs.ecx), "=d"(regs.edx)
+		:"a"(leaf), "c"(0));
+
+	return regs;
+}
+
+// Zero if cpuid or the features leaf is unsupported.
+static inline uint32_t cpuid_get_features_edx () {
+	if (!cpuid_is_supported () ||
+			CPUID_LEAF_FEATURES > cpuid (CPUID_LEAF_VENDOR).eax)
+		return 0;
+
+	return cpuid (CPUID_LEAF_FEATURES).edx;
+}
+
+#endif
+
+// vim: set ts=4 sw=4 noet syn=c:
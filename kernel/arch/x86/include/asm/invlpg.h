@@ -5,24 +5,14 @@
 
 #include <mm/page.h>
 
-#pragma GCC diagnostic ignored "-Wunused-parameter"
-static inline void invlpg (page_t *physical_page_offset) {
-#ifdef __i486__
+// The kernel already needs a 486 or later for cpuid, so the instruction is always there.
+static inline void invlpg (page_t *virtual) {
 	asm volatile (
 		"invlpg		(%0);\n"
 		:
-		:"r"(physical_page_offset)
+		:"r"(virtual)
 		:"memory");
-#else
-	asm volatile (
-		"mov		%%cr3,				%%eax;\n"
-		"mov		%%eax,				%%cr3;\n"
-		:
-		:
-		:"memory", "eax");
-#endif
 }
-#pragma GCC diagnostic pop
 
 #endif
 
@@ -0,0 +1,21 @@
+// kernel/arch/x86/include/asm/stos.h
+
+#ifndef IZIX_ASM_STOS_H
+#define IZIX_ASM_STOS_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fill count longs at dest with value.
+static inline void stosl (void *dest, uint32_t value, size_t count) {
+	asm volatile (
+		"		cld;\n"
+		"		rep stosl;\n"
+		:"+D"(dest), "+c"(count)
+		:"a"(value)
+		:"memory");
+}
+
+#endif
+
+// vim: set ts=4 sw=4 noet syn=c:
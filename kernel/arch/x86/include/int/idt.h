@@ -166,6 +166,8 @@ static inline idt_register_logical_t idt_register_decode (
 
 void idt_init ();
 void idt_set_isr (interupt_vector_t, void (*) ());
+// Handle the vector by switching to the task of the TSS selector.
+void idt_set_task (interupt_vector_t, segment_selector_t);
 void idt_load ();
 
 #endif
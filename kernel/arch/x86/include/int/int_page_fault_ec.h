@@ -0,0 +1,46 @@
+// kernel/arch/x86/include/int/int_page_fault_ec.h
+
+#ifndef IZIX_INT_PAGE_FAULT_EC_H
+#define IZIX_INT_PAGE_FAULT_EC_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <attributes.h>
+
+typedef struct PACKED int_page_fault_ec_struct {
+	unsigned char present  : 1; // Protection violation rather than an absent page.
+	unsigned char write    : 1;
+	unsigned char user     : 1;
+	unsigned char reserved : 1; // A reserved bit was set in a paging structure.
+	unsigned char fetch    : 1;
+	unsigned char _rsv0    : 3;
+	unsigned char _rsv1;
+	uint16_t      _rsv2;
+} MAY_ALIAS int_page_fault_ec_t;
+
+typedef struct int_page_fault_ec_logical_struct {
+	bool present;
+	bool write;
+	bool user;
+	bool reserved;
+	bool fetch;
+} int_page_fault_ec_logical_t;
+
+static inline int_page_fault_ec_logical_t int_page_fault_ec_decode (
+		int_page_fault_ec_t page_fault_ec
+) {
+	int_page_fault_ec_logical_t logical_page_fault_ec = {
+		.present  = page_fault_ec.present  ? true : false,
+		.write    = page_fault_ec.write    ? true : false,
+		.user     = page_fault_ec.user     ? true : false,
+		.reserved = page_fault_ec.reserved ? true : false,
+		.fetch    = page_fault_ec.fetch    ? true : false
+	};
+
+	return logical_page_fault_ec;
+}
+
+#endif
+
+// vim: set ts=4 sw=4 noet syn=c:
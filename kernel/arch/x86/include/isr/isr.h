@@ -6,6 +6,7 @@
 void isr_df ();
 void isr_np ();
 void isr_gp ();
+void isr_pf ();
 
 void isr_irq0 ();
 void isr_irq1 ();
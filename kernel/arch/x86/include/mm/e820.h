@@ -13,10 +13,14 @@
 #define IZIX_SUPPORT_E820_3X
 #endif
 
+// The entries are left where the bootloader put them until they are cloned into memblock,
+// which must happen once everything else in use is reserved and before anything else is
+// allocated from memblock.
+
 #ifdef IZIX_SUPPORT_E820_3X
 void e820_3x_register (size_t entry_count, void *entries);
 void e820_3x_print ();
-void e820_3x_add_freemem ();
+void e820_3x_add_memblock ();
 void e820_3x_clone ();
 void e820_3x_map_physical ();
 #endif
@@ -24,7 +28,7 @@ void e820_3x_map_physical ();
 #ifdef IZIX_SUPPORT_E820_LEGACY
 void e820_legacy_register (size_t entry_count, void *entries);
 void e820_legacy_print ();
-void e820_legacy_add_freemem ();
+void e820_legacy_add_memblock ();
 void e820_legacy_clone ();
 void e820_legacy_map_physical (paging_data_t *);
 #endif
@@ -0,0 +1,48 @@
+// kernel/arch/x86/include/mm/fault.h
+
+#ifndef IZIX_FAULT_H
+#define IZIX_FAULT_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <attributes.h>
+
+#include <mm/freemem.h>
+#include <mm/page.h>
+
+// Stacks live in fixed slots of their own window.  Everything in a slot below the stack
+// is never mapped, so an overflow faults instead of running into other memory.
+#define FAULT_STACK_SLOTS     256
+#define FAULT_STACK_SLOT_SIZE (16 * (size_t)PAGE_SIZE)
+#define FAULT_STACK_START     ((void *)0xe0000000)
+#define FAULT_STACK_END       (FAULT_STACK_START + FAULT_STACK_SLOTS * FAULT_STACK_SLOT_SIZE)
+
+// Must be called after paging is enabled, and before any lazy areas or stacks are used.
+void fault_init ();
+
+// Lazy areas are backed by zeroed pages on first touch, until then they need only their
+// page tables.  The start and length must be page aligned, and the area must not be
+// mapped already.  Paging must be enabled.  Will return false if the area overlaps
+// another or no memory is available.
+bool fault_add_lazy_area (void *, size_t);
+// Pages which were touched stay mapped, it is up to the owner to release them.
+void fault_remove_lazy_area (void *);
+// Return true if the address lies within a lazy area.
+bool fault_is_lazy (const void *);
+
+// Only the top page of the stack is committed, the rest are backed as it grows.  The
+// length must be page aligned and leave at least one guard page in the slot.  Will return
+// an empty region if no memory is available.
+freemem_region_t fault_stack_alloc (size_t, size_t);
+void fault_stack_free (void *);
+bool fault_stack_owns (const void *);
+
+// Called from the fault task with the faulting address and the error code.
+FASTCALL
+void fault_handler (void *, uint32_t);
+
+#endif
+
+// vim: set ts=4 sw=4 noet syn=c:
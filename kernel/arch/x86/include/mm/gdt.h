@@ -14,8 +14,10 @@
 #define GDT_USERSPACE_CODE_SELECTOR ((segment_selector_t)0x0018)
 #define GDT_USERSPACE_DATA_SELECTOR ((segment_selector_t)0x0020)
 #define GDT_SUPERVISOR_TSS_SELECTOR  ((segment_selector_t)0x0028)
+#define GDT_FAULT_TSS_SELECTOR  ((segment_selector_t)0x0030)
 
-void gdt_init (tss_t *);
+// The TSS of the kernel, then the TSS of the page fault task.
+void gdt_init (tss_t *, tss_t *);
 
 #endif
 
@@ -13,6 +13,9 @@
 #define PAGE_ALIGN_UPPER_WIDTH 024
 #define PAGE_ALIGN_LOWER_WIDTH (8 * sizeof(void *) - PAGE_ALIGN_UPPER_WIDTH)
 
+// A whole page table's worth of memory mapped by a single directory entry.
+#define PAGE_LARGE_SIZE (1024 * (size_t)PAGE_SIZE)
+
 typedef struct page_attrs_struct {
 	bool    present;
 	bool    writable;
@@ -168,12 +171,26 @@ static inline page_directory_entry_logical_t page_directory_entry_decode (
 void paging_init (paging_data_t *);
 void paging_enable (paging_data_t *);
 void paging_switch (paging_data_t *);
+// NULL until paging has been enabled.
+paging_data_t *paging_get_kernel_data ();
+// True if the processor supports PAGE_LARGE_SIZE pages.
+bool paging_large_supported ();
 bool paging_table_present (page_t *, paging_data_t *);
 void paging_set_map (page_t *, page_t *, paging_data_t *);
+// Both addresses must be aligned to PAGE_LARGE_SIZE and nothing may be mapped there yet.
+// Changing a single page within a large page later splits it into a table.
+void paging_set_large_map (page_t *, page_t *, page_attrs_t, paging_data_t *);
 page_t *paging_get_map (page_t *, paging_data_t *);
 void paging_set_attrs (page_t *, page_attrs_t, paging_data_t *);
 page_attrs_t paging_get_attrs (page_t *, paging_data_t *);
 page_attrs_t paging_compatable_attrs (page_attrs_t, page_attrs_t);
+// Map a run of pages, writing each table entry once and flushing the TLB once at the end.
+// Aligned runs of PAGE_LARGE_SIZE become large pages where possible.
+void paging_map_range (page_t *, page_t *, size_t, page_attrs_t, paging_data_t *);
+// As paging_map_range, but the attributes are made compatable with those already set.
+void paging_map_range_compatable (page_t *, page_t *, size_t, page_attrs_t, paging_data_t *);
+// Set only the attributes of a run of pages, all of which must have tables.
+void paging_protect_range (page_t *, size_t, page_attrs_t, paging_data_t *);
 
 #endif
 
@@ -0,0 +1,53 @@
+// kernel/arch/x86/include/mm/tlb.h
+
+#ifndef IZIX_TLB_H
+#define IZIX_TLB_H 1
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <mm/page.h>
+
+// Past this many pages a single full flush is cheaper than invalidating each.
+#define TLB_BATCH_MAX 32
+
+// Collects invalidations so they can be done at once, after every entry is rewritten.
+typedef struct tlb_batch_struct {
+	page_t *pages[TLB_BATCH_MAX];
+	size_t count;
+	// More pages were added than fit, the whole TLB will be flushed.
+	bool overflow;
+} tlb_batch_t;
+
+typedef struct tlb_stats_struct {
+	size_t page_flushes;
+	size_t full_flushes;
+	// Invalidations avoided by collapsing batches into a full flush.
+	size_t collapsed;
+} tlb_stats_t;
+
+static inline tlb_batch_t new_tlb_batch () {
+	tlb_batch_t batch = {
+		.count = 0,
+		.overflow = false
+	};
+
+	return batch;
+}
+
+// True if the processor can keep global pages across address space switches.
+bool tlb_global_supported ();
+// Must be called once paging is enabled, nothing is flushed before then.
+void tlb_enable ();
+void tlb_flush_page (page_t *);
+void tlb_flush_range (page_t *, size_t);
+// Flushes global pages as well.
+void tlb_flush_all ();
+void tlb_batch_add (tlb_batch_t *, page_t *);
+void tlb_batch_add_range (tlb_batch_t *, page_t *, size_t);
+void tlb_batch_flush (tlb_batch_t *);
+tlb_stats_t tlb_get_stats ();
+
+#endif
+
+// vim: set ts=4 sw=4 noet syn=c:
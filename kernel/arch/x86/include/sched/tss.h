@@ -225,6 +225,9 @@ static inline tss_t tss_encode (tss_logical_t logical_tss) {
 
 void tss_init (void *);
 tss_t *tss_get ();
+// The page fault task runs on its own stack, so faults on a stack can be resolved.
+tss_t *tss_get_fault ();
+void tss_set_fault_task (void (*) (), void *, uint32_t);
 void tss_load (segment_selector_t);
 
 #endif
@@ -62,6 +62,21 @@ void idt_set_isr (interupt_vector_t vector, void (*isr) ()) {
 	logical_registry.base[vector] = idt_entry_encode (logical_entry);
 }
 
+void idt_set_task (interupt_vector_t vector, segment_selector_t tss_selector) {
+	idt_register_logical_t logical_registry;
+	idt_entry_logical_t logical_entry;
+
+	logical_registry = idt_register_decode (*idt_registry);
+	logical_entry = idt_entry_decode (logical_registry.base[vector]);
+
+	logical_entry.present = true;
+	logical_entry.isr_offset = NULL;
+	logical_entry.selector = tss_selector;
+	logical_entry.type = IDT_I386_TASK_GATE;
+
+	logical_registry.base[vector] = idt_entry_encode (logical_entry);
+}
+
 COLD
 void idt_load () {
 	asm volatile (
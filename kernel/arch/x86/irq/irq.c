@@ -1,10 +1,13 @@
 // kernel/arch/x86/irq/irq.c
 
+#include <stdalign.h>
+
 #include <attributes.h>
 #include <collections/linked_list.h>
 
 #include <asm/toggle_int.h>
 #include <mm/malloc.h>
+#include <mm/slab.h>
 #include <kprint/kprint.h>
 #include <kpanic/kpanic.h>
 #include <irq/irq_vectors.h>
@@ -19,6 +22,8 @@ TPL_LINKED_LIST(irq_hook, irq_hook_t)
 static volatile linked_list_irq_hook_t *irq_pre_hooks;
 static volatile linked_list_irq_hook_t *irq_post_hooks;
 
+static kmem_cache_t *irq_hook_node_cache;
+
 FASTCALL
 static volatile linked_list_irq_hook_t *irq_get_pre_hook_list (irq_t);
 FASTCALL FAST HOT
@@ -37,8 +42,7 @@ static void irq_add_hook (
 		volatile linked_list_irq_hook_t *hook_list,
 		irq_hook_t hook
 ) {
-	linked_list_irq_hook_node_t *hook_node =
-		malloc (sizeof(linked_list_irq_hook_node_t));
+	linked_list_irq_hook_node_t *hook_node = kmem_cache_alloc (irq_hook_node_cache);
 	if (!hook_node) {
 		kputs ("irq/irq: Failed to allocate IRQ hook node while adding a hook!\n");
 		kpanic ();
@@ -77,13 +81,27 @@ COLD
 void irq_init () {
 	irq_t irq;
 
-	irq_pre_hooks = malloc (IRQ_NUMBER_OF_IRQ_LINES * sizeof(linked_list_irq_hook_t));
-	irq_post_hooks = malloc (IRQ_NUMBER_OF_IRQ_LINES * sizeof(linked_list_irq_hook_t));
+	irq_pre_hooks = aligned_alloc (
+		alignof(linked_list_irq_hook_t),
+		IRQ_NUMBER_OF_IRQ_LINES * sizeof(linked_list_irq_hook_t));
+	irq_post_hooks = aligned_alloc (
+		alignof(linked_list_irq_hook_t),
+		IRQ_NUMBER_OF_IRQ_LINES * sizeof(linked_list_irq_hook_t));
 	if (!irq_pre_hooks || !irq_post_hooks) {
 		kputs ("irq/irq: Failed to allocate IRQ hook lists!\n");
 		kpanic ();
 	}
 
+	irq_hook_node_cache = kmem_cache_create (
+		"irq_hook",
+		sizeof(linked_list_irq_hook_node_t),
+		alignof(linked_list_irq_hook_node_t),
+		NULL);
+	if (!irq_hook_node_cache) {
+		kputs ("irq/irq: Failed to create IRQ hook node cache!\n");
+		kpanic ();
+	}
+
 	for (irq = 0; IRQ_NUMBER_OF_IRQ_LINES > irq; ++irq) {
 		// Don't mask the slave PIC_8253
 		if (2 == irq)
@@ -0,0 +1,25 @@
+// kernel/arch/x86/isr/pf.s
+
+.file		"pf.s"
+
+.code32
+
+.section	.text
+
+	.globl	isr_pf
+	.type	isr_pf,		@function
+// Entered through a task gate on the fault task's own stack, which only holds the error
+// code.  The task resumes after its iret on the next fault, so it loops back here.
+isr_pf:
+	// Error code in %edx, faulting address in %ecx.
+	// Both are arguments to the fastcall handler.
+	pop	%edx
+	mov	%cr2,		%ecx
+
+	call	fault_handler
+
+	iret
+	jmp	isr_pf
+	.size	isr_pf,		.-isr_pf
+
+// vim: set ts=8 sw=8 noet syn=asm:
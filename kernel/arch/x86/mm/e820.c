@@ -15,9 +15,11 @@
 #include <kpanic/kpanic.h>
 #include <mm/freemem.h>
 #include <mm/malloc.h>
+#include <mm/memblock.h>
 #include <mm/e820.h>
 #include <mm/page.h>
 #include <mm/paging.h>
+#include <mm/tlb.h>
 
 #define E820_FORMAT_STR_BASE "mm/e820: length=0x%016llx base=*0x%016llx %s"
 
@@ -76,21 +78,22 @@ static size_t e820_get_bounded_length (uint64_t length, uint64_t base) {
 }
 
 COLD
-static void e820_add_freemem (uint64_t length_u64, uint64_t base_u64) {
+static void e820_add_memblock (uint64_t length_u64, uint64_t base_u64) {
 	const size_t length = e820_get_bounded_length (length_u64, base_u64);
 	if (!length)
 		return;
 
 	// Gurenteed to be within bounds because e820_get_bounded_length returned non-zero.
-	void *const base = (void *)(size_t)base_u64;
+	memblock_add (new_freemem_region ((void *)(size_t)base_u64, length));
+}
 
-	const freemem_region_t region = new_freemem_region (base, length);
+COLD
+static void e820_reserve_memblock (uint64_t length_u64, uint64_t base_u64) {
+	const size_t length = e820_get_bounded_length (length_u64, base_u64);
+	if (!length)
+		return;
 
-	const bool add_success = freemem_add_region (region);
-	if (!add_success) {
-		kputs ("mm/e820: Failed to add freemem region!\n");
-		kpanic ();
-	}
+	memblock_reserve (new_freemem_region ((void *)(size_t)base_u64, length));
 }
 
 COLD
@@ -121,23 +124,12 @@ static void e820_map_page (
 	if (page_length % PAGE_SIZE)
 		page_length += PAGE_SIZE - page_length % PAGE_SIZE;
 
-	while (page_length) {
-		page_t *virtual = page_base;
+	page_attrs_t attrs = e820_type_attrs[type - 1];
+	if (!volatility)
+		attrs.write_through = true;
 
-		page_attrs_t compat_attrs = e820_type_attrs[type - 1];
-		if (!volatility)
-			compat_attrs.write_through = true;
-		if (paging_table_present (virtual, paging_data)) {
-			page_attrs_t old_attrs = paging_get_attrs (virtual, paging_data);
-			compat_attrs = paging_compatable_attrs (compat_attrs, old_attrs);
-		}
-
-		paging_set_map (virtual, virtual, paging_data);
-		paging_set_attrs (virtual, compat_attrs, paging_data);
-
-		page_length -= PAGE_SIZE;
-		page_base += 1;
-	}
+	paging_map_range_compatable (
+		page_base, page_base, page_length / PAGE_SIZE, attrs, paging_data);
 }
 
 CONSTRUCTOR
@@ -150,7 +142,7 @@ void e820_construct () {
 		.cache_disabled = false,
 		.accessed       = false,
 		.dirty          = false,
-		.global         = false
+		.global         = tlb_global_supported ()
 	};
 	e820_type_attrs[e820_acpi_nvs - 1]  = (page_attrs_t){
 		.present        = false, // Page fault on access.
@@ -242,13 +234,23 @@ static void e820_entry_3x_print (e820_entry_3x_t entry) {
 }
 
 COLD
-static void e820_entry_3x_add_freemem (e820_entry_3x_t entry) {
+static void e820_entry_3x_add_memblock (e820_entry_3x_t entry) {
 	if (!entry.length ||
 			e820_usable != entry.type ||
 			e820_3x_ignore == entry.xattrs.ignored)
 		return;
 
-	e820_add_freemem (entry.length, entry.base);
+	e820_add_memblock (entry.length, entry.base);
+}
+
+COLD
+static void e820_entry_3x_reserve_memblock (e820_entry_3x_t entry) {
+	if (!entry.length ||
+			e820_usable == entry.type ||
+			e820_3x_ignore == entry.xattrs.ignored)
+		return;
+
+	e820_reserve_memblock (entry.length, entry.base);
 }
 
 COLD
@@ -276,23 +278,29 @@ void e820_3x_register (size_t entry_count, void *entries) {
 }
 
 COLD
-void e820_3x_add_freemem () {
+void e820_3x_add_memblock () {
 	size_t i;
 	for (i = 0; e820_entry_count > i; ++i)
-		e820_entry_3x_add_freemem (e820_entries_3x[i]);
+		e820_entry_3x_add_memblock (e820_entries_3x[i]);
+
+	// Firmware may report reserved memory within usable entries, the reserved type wins.
+	for (i = 0; e820_entry_count > i; ++i)
+		e820_entry_3x_reserve_memblock (e820_entries_3x[i]);
 }
 
+// The entries where the bootloader left them are never reserved, so the copy may
+// overlap them.
 COLD
 void e820_3x_clone () {
 	const size_t entries_size = e820_entry_count * sizeof(e820_entry_3x_t);
 
-	e820_entry_3x_t *new_entries = malloc (entries_size);
+	e820_entry_3x_t *new_entries = memblock_alloc (entries_size, MALLOC_ALIGNMENT);
 	if (!new_entries) {
 		kputs ("mm/e820: Failed to allocate new e820 entries!\n");
 		kpanic ();
 	}
 
-	memcpy (new_entries, e820_entries_3x, entries_size);
+	memmove (new_entries, e820_entries_3x, entries_size);
 
 	e820_entries_3x = new_entries;
 }
@@ -329,12 +337,21 @@ static void e820_entry_legacy_print (e820_entry_legacy_t entry) {
 }
 
 COLD
-static void e820_entry_legacy_add_freemem (e820_entry_legacy_t entry) {
+static void e820_entry_legacy_add_memblock (e820_entry_legacy_t entry) {
 	if (!entry.length ||
 			e820_usable != entry.type)
 		return;
 
-	e820_add_freemem (entry.length, entry.base);
+	e820_add_memblock (entry.length, entry.base);
+}
+
+COLD
+static void e820_entry_legacy_reserve_memblock (e820_entry_legacy_t entry) {
+	if (!entry.length ||
+			e820_usable == entry.type)
+		return;
+
+	e820_reserve_memblock (entry.length, entry.base);
 }
 
 COLD
@@ -361,23 +378,29 @@ void e820_legacy_register (size_t entry_count, void *entries) {
 }
 
 COLD
-void e820_legacy_add_freemem () {
+void e820_legacy_add_memblock () {
 	size_t i;
 	for (i = 0; e820_entry_count > i; ++i)
-		e820_entry_legacy_add_freemem (e820_entries_legacy[i]);
+		e820_entry_legacy_add_memblock (e820_entries_legacy[i]);
+
+	// Firmware may report reserved memory within usable entries, the reserved type wins.
+	for (i = 0; e820_entry_count > i; ++i)
+		e820_entry_legacy_reserve_memblock (e820_entries_legacy[i]);
 }
 
+// The entries where the bootloader left them are never reserved, so the copy may
+// overlap them.
 COLD
 void e820_legacy_clone () {
 	const size_t entries_size = e820_entry_count * sizeof(e820_entry_legacy_t);
 
-	e820_entry_legacy_t *new_entries = malloc (entries_size);
+	e820_entry_legacy_t *new_entries = memblock_alloc (entries_size, MALLOC_ALIGNMENT);
 	if (!new_entries) {
 		kputs ("mm/e820: Failed to allocate new e820 entries!\n");
 		kpanic ();
 	}
 
-	memcpy (new_entries, e820_entries_legacy, entries_size);
+	memmove (new_entries, e820_entries_legacy, entries_size);
 
 	e820_entries_legacy = new_entries;
 }
@@ -0,0 +1,436 @@
+// kernel/arch/x86/mm/fault.c
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdalign.h>
+
+#include <attributes.h>
+#include <collections/bintree.h>
+#include <string.h>
+
+#include <asm/toggle_int.h>
+#include <kprint/kprint.h>
+#include <kpanic/kpanic.h>
+#include <int/idt.h>
+#include <int/int_page_fault_ec.h>
+#include <isr/isr.h>
+#include <mm/buddy.h>
+#include <mm/fault.h>
+#include <mm/gdt.h>
+#include <mm/page.h>
+#include <mm/paging.h>
+#include <mm/slab.h>
+#include <mm/tlb.h>
+#include <sched/kthread.h>
+#include <sched/spinlock.h>
+#include <sched/tss.h>
+
+// Faults are handled by a task of their own, so that a fault on a stack doesn't need
+// that stack to push its frame.  The fault task must never yield: it can't be entered
+// again until it returns.  So it only ever tries locks, and keeps a reserve of pages
+// for when the buddy allocator is busy.
+
+#define FAULT_TASK_STACK_ORDER 1
+
+#define FAULT_RESERVE_PAGES 8
+
+// Length of the area.
+TPL_BINTREE (lazy_area, size_t)
+
+static bintree_lazy_area_t
+	fault_lazy_areas_base,
+	*fault_lazy_areas = &fault_lazy_areas_base;
+
+static kmem_cache_t *fault_lazy_area_cache;
+
+// Held only with interrupts disabled, so the fault task never finds it taken by a
+// preempted thread.
+static spinlock_t
+	fault_lock_base,
+	*fault_lock = &fault_lock_base;
+
+static spinlock_t
+	fault_reserve_lock_base,
+	*fault_reserve_lock = &fault_reserve_lock_base;
+
+static page_t *fault_reserve[FAULT_RESERVE_PAGES];
+static volatile size_t fault_reserve_count = 0;
+
+// Length of the stack in each slot, zero if the slot is free.
+static size_t fault_stack_lengths[FAULT_STACK_SLOTS];
+
+CONSTRUCTOR
+static void fault_construct () {
+	fault_lock_base = new_spinlock ();
+	fault_reserve_lock_base = new_spinlock ();
+	fault_lazy_areas_base = new_bintree_lazy_area ();
+
+	fault_lazy_area_cache = kmem_cache_create (
+		"fault_lazy_area",
+		sizeof(bintree_lazy_area_node_t),
+		alignof(bintree_lazy_area_node_t),
+		NULL);
+	if (!fault_lazy_area_cache) {
+		kputs ("mm/fault: Failed to create lazy area node cache!\n");
+		kpanic ();
+	}
+}
+
+static bool fault_lock_registry () {
+	const bool int_enabled = int_is_enabled ();
+
+	for (;;) {
+		disable_int ();
+		if (spinlock_try_lock (fault_lock))
+			return int_enabled;
+
+		if (int_enabled)
+			enable_int ();
+		kthread_yield_contended ();
+	}
+}
+
+static void fault_unlock_registry (bool int_enabled) {
+	spinlock_release (fault_lock);
+
+	if (int_enabled)
+		enable_int ();
+}
+
+static page_attrs_t fault_lazy_attrs (bool present) {
+	page_attrs_t attrs = {
+		.present = present,
+		.writable = present,
+		.user = false,
+		.write_through = false,
+		.cache_disabled = false,
+		.accessed = false,
+		.dirty = false,
+		.global = tlb_global_supported ()
+	};
+
+	return attrs;
+}
+
+static void fault_reserve_refill () {
+	spinlock_lock (fault_reserve_lock);
+
+	while (FAULT_RESERVE_PAGES > fault_reserve_count) {
+		page_t *page = buddy_alloc (0);
+		if (!page)
+			break;
+
+		// The fault task may take from the top between any two faulting instructions,
+		// but never while interrupts are disabled and nothing here touches the stack.
+		const bool int_enabled = int_is_enabled ();
+		disable_int ();
+		fault_reserve[fault_reserve_count] = page;
+		fault_reserve_count += 1;
+		if (int_enabled)
+			enable_int ();
+	}
+
+	spinlock_release (fault_reserve_lock);
+}
+
+// Only called from the fault task.
+static page_t *fault_get_zeroed_page () {
+	page_t *page = buddy_try_alloc_zeroed (0);
+
+	if (!page && fault_reserve_count) {
+		fault_reserve_count -= 1;
+		page = fault_reserve[fault_reserve_count];
+		memset (page, 0, PAGE_SIZE);
+	}
+
+	return page;
+}
+
+// The area starting at or below the address, or NULL if there is none.
+static bintree_lazy_area_node_t *fault_get_floor (size_t address) {
+	bintree_lazy_area_iterator_t iterator_base, *iterator = &iterator_base;
+	bintree_lazy_area_node_t *area_node =
+		fault_lazy_areas->search (fault_lazy_areas, address);
+
+	if (!area_node || address >= area_node->orderby)
+		return area_node;
+
+	iterator_base = new_bintree_lazy_area_iterator (area_node);
+
+	return iterator->prev (iterator);
+}
+
+static bintree_lazy_area_node_t *fault_get_area (size_t address) {
+	bintree_lazy_area_node_t *area_node = fault_get_floor (address);
+
+	if (!area_node || address - area_node->orderby >= area_node->data)
+		return NULL;
+
+	return area_node;
+}
+
+static bool fault_overlaps (size_t start, size_t length) {
+	bintree_lazy_area_iterator_t iterator_base, *iterator = &iterator_base;
+	bintree_lazy_area_node_t *area_node = fault_get_floor (start);
+
+	if (area_node) {
+		if (start - area_node->orderby < area_node->data)
+			return true;
+
+		iterator_base = new_bintree_lazy_area_iterator (area_node);
+		area_node = iterator->next (iterator);
+	} else {
+		area_node = fault_lazy_areas->min (fault_lazy_areas);
+	}
+
+	return area_node && area_node->orderby - start < length;
+}
+
+static paging_data_t *fault_get_paging_data () {
+	paging_data_t *paging_data = paging_get_kernel_data ();
+
+	if (!paging_data) {
+		kputs ("mm/fault: Paging must be enabled first!\n");
+		kpanic ();
+	}
+
+	return paging_data;
+}
+
+void fault_init () {
+	paging_data_t *paging_data = fault_get_paging_data ();
+
+	void *stack = buddy_alloc (FAULT_TASK_STACK_ORDER);
+	if (!stack) {
+		kputs ("mm/fault: Failed to allocate the fault task stack!\n");
+		kpanic ();
+	}
+
+	tss_set_fault_task (
+		isr_pf,
+		stack + (PAGE_SIZE << FAULT_TASK_STACK_ORDER),
+		(uint32_t)*paging_data);
+	idt_set_task (IDT_PF_VECTOR, GDT_FAULT_TSS_SELECTOR);
+
+	fault_reserve_refill ();
+}
+
+bool fault_add_lazy_area (void *start, size_t length) {
+	paging_data_t *paging_data = fault_get_paging_data ();
+	bintree_lazy_area_node_t *area_node;
+
+	if ((size_t)start % PAGE_SIZE || length % PAGE_SIZE) {
+		kputs ("mm/fault: Lazy area is not page aligned!\n");
+		kpanic ();
+	}
+
+	if (!length || fault_stack_owns (start))
+		return false;
+
+	area_node = kmem_cache_alloc (fault_lazy_area_cache);
+	if (!area_node)
+		return false;
+
+	// Every page starts absent, this also creates the tables the fault task needs.
+	paging_map_range (
+		start, NULL, length / PAGE_SIZE, fault_lazy_attrs (false), paging_data);
+
+	const bool int_enabled = fault_lock_registry ();
+
+	if (fault_overlaps ((size_t)start, length)) {
+		fault_unlock_registry (int_enabled);
+		kmem_cache_free (fault_lazy_area_cache, area_node);
+		return false;
+	}
+
+	*area_node = new_bintree_lazy_area_node (length, (size_t)start);
+	fault_lazy_areas->insert (fault_lazy_areas, area_node);
+
+	fault_unlock_registry (int_enabled);
+
+	fault_reserve_refill ();
+
+	return true;
+}
+
+void fault_remove_lazy_area (void *start) {
+	const bool int_enabled = fault_lock_registry ();
+
+	bintree_lazy_area_node_t *area_node =
+		fault_lazy_areas->search (fault_lazy_areas, (size_t)start);
+	if (!area_node || (size_t)start != area_node->orderby) {
+		kputs ("mm/fault: Attempt to remove absent lazy area!\n");
+		kpanic ();
+	}
+
+	fault_lazy_areas->remove (fault_lazy_areas, area_node);
+
+	fault_unlock_registry (int_enabled);
+
+	kmem_cache_free (fault_lazy_area_cache, area_node);
+}
+
+bool fault_is_lazy (const void *address) {
+	const bool int_enabled = fault_lock_registry ();
+
+	const bool is_lazy = NULL != fault_get_area ((size_t)address);
+
+	fault_unlock_registry (int_enabled);
+
+	return is_lazy;
+}
+
+static size_t fault_stack_get_slot (const void *ptr) {
+	return ((size_t)ptr - (size_t)FAULT_STACK_START) / FAULT_STACK_SLOT_SIZE;
+}
+
+static page_t *fault_stack_get_top (size_t slot) {
+	return (page_t *)(FAULT_STACK_START + (slot + 1) * FAULT_STACK_SLOT_SIZE);
+}
+
+freemem_region_t fault_stack_alloc (size_t slot, size_t length) {
+	paging_data_t *paging_data = fault_get_paging_data ();
+
+	if (FAULT_STACK_SLOTS <= slot ||
+			length % PAGE_SIZE ||
+			!length ||
+			FAULT_STACK_SLOT_SIZE - PAGE_SIZE < length) {
+		kputs ("mm/fault: Invalid stack slot or length!\n");
+		kpanic ();
+	}
+
+	if (fault_stack_lengths[slot]) {
+		kputs ("mm/fault: Stack slot is already in use!\n");
+		kpanic ();
+	}
+
+	page_t *const top = fault_stack_get_top (slot);
+	const size_t pages = length / PAGE_SIZE;
+
+	// Only the top page is committed, the rest are backed as the stack grows into them.
+	page_t *committed = buddy_alloc (0);
+	if (!committed)
+		return new_freemem_region (NULL, 0);  // ENOMEM
+
+	paging_map_range (
+		top - pages, NULL, pages - 1, fault_lazy_attrs (false), paging_data);
+	paging_map_range (top - 1, committed, 1, fault_lazy_attrs (true), paging_data);
+
+	fault_stack_lengths[slot] = length;
+
+	fault_reserve_refill ();
+
+	return new_freemem_region (top - pages, length);
+}
+
+void fault_stack_free (void *stack) {
+	paging_data_t *paging_data = fault_get_paging_data ();
+	size_t i;
+
+	const size_t slot = fault_stack_get_slot (stack);
+	const size_t pages = fault_stack_lengths[slot] / PAGE_SIZE;
+	page_t *const top = fault_stack_get_top (slot);
+
+	if (!fault_stack_owns (stack) || !pages || top - pages != (page_t *)stack) {
+		kputs ("mm/fault: Attempt to free absent stack!\n");
+		kpanic ();
+	}
+
+	// The stack is unmapped and flushed before its frames are returned.  Pages it never
+	// grew into were mapped to NULL by fault_stack_alloc.
+	paging_protect_range (top - pages, pages, fault_lazy_attrs (false), paging_data);
+
+	for (i = 1; pages >= i; ++i) {
+		page_t *physical = paging_get_map (top - i, paging_data);
+
+		if (physical)
+			buddy_free (physical, 0);
+	}
+
+	fault_stack_lengths[slot] = 0;
+}
+
+bool fault_stack_owns (const void *ptr) {
+	return FAULT_STACK_START <= ptr && FAULT_STACK_END > ptr;
+}
+
+// Back the page with a zeroed frame, returns false if the fault is not ours to handle.
+static bool fault_handle_stack (page_t *virtual) {
+	const size_t slot = fault_stack_get_slot (virtual);
+	const size_t length = fault_stack_lengths[slot];
+
+	if ((size_t)fault_stack_get_top (slot) - (size_t)virtual > length) {
+		kprintf (
+			"mm/fault: Stack %s in slot %u!\n",
+			length ? "overflow" : "access", slot);
+		return false;
+	}
+
+	page_t *physical = fault_get_zeroed_page ();
+	if (!physical) {
+		kputs ("mm/fault: Out of memory growing stack!\n");
+		return false;
+	}
+
+	paging_map_range (
+		virtual, physical, 1, fault_lazy_attrs (true), paging_get_kernel_data ());
+
+	return true;
+}
+
+// Back the page with a zeroed frame, returns false if the fault is not ours to handle.
+static bool fault_handle_lazy (page_t *virtual) {
+	paging_data_t *paging_data = paging_get_kernel_data ();
+	bool handled = false;
+
+	// Only the faulting code itself could be holding it.
+	if (!spinlock_try_lock (fault_lock)) {
+		kputs ("mm/fault: Lazy area fault while changing lazy areas!\n");
+		return false;
+	}
+
+	if (fault_get_area ((size_t)virtual)) {
+		page_t *physical = fault_get_zeroed_page ();
+
+		if (physical) {
+			paging_map_range (virtual, physical, 1, fault_lazy_attrs (true), paging_data);
+			handled = true;
+		} else {
+			kputs ("mm/fault: Out of memory backing lazy page!\n");
+		}
+	}
+
+	spinlock_release (fault_lock);
+
+	return handled;
+}
+
+FASTCALL
+void fault_handler (void *address, uint32_t error_code) {
+	const int_page_fault_ec_logical_t logical_page_fault_ec =
+		int_page_fault_ec_decode (*(int_page_fault_ec_t *)&error_code);
+
+	page_t *const virtual = (page_t *)((size_t)address - (size_t)address % PAGE_SIZE);
+
+	if (!logical_page_fault_ec.present && !logical_page_fault_ec.reserved) {
+		const bool handled = fault_stack_owns (address) ?
+			fault_handle_stack (virtual) :
+			fault_handle_lazy (virtual);
+
+		if (handled)
+			return;
+	}
+
+	kprintf (
+		"mm/fault: Caught #PF %s %p (%s%s%s)!\n",
+		logical_page_fault_ec.fetch ? "fetching" :
+			logical_page_fault_ec.write ? "writing" : "reading",
+		address,
+		logical_page_fault_ec.present ? "protection" : "absent",
+		logical_page_fault_ec.user ? ", user" : "",
+		logical_page_fault_ec.reserved ? ", reserved bit" : "");
+	kpanic ();
+}
+
+// vim: set ts=4 sw=4 noet syn=c:
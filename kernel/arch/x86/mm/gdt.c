@@ -21,7 +21,8 @@
 	MAX(GDT_SUPERVISOR_DATA_SELECTOR, \
 	MAX(GDT_USERSPACE_CODE_SELECTOR, \
 	MAX(GDT_USERSPACE_DATA_SELECTOR, \
-		GDT_SUPERVISOR_TSS_SELECTOR))))
+	MAX(GDT_SUPERVISOR_TSS_SELECTOR, \
+		GDT_FAULT_TSS_SELECTOR)))))
 
 #define GDT_LENGTH \
 	(GDT_MAX_SELECTOR + sizeof(gdt_entry_t))
@@ -168,13 +169,29 @@ typedef struct PACKED gdt_register_struct {
 static gdt_register_t gdtr;
 
 COLD
-static void gdt_populate (tss_t *tss) {
+static gdt_entry_tss_t gdt_get_tss_entry (tss_t *tss) {
+	gdt_entry_tss_t entry = {
+		.limit_low = sizeof(tss_t),
+		.base_low = (size_t)tss,
+		.access = GDT_TSS_ACCESS,
+		.limit_high = sizeof(tss_t) >> GDT_LIMIT_HIGH_OFFSET,
+		.size = gdt_32bit,
+		.granularity = gdt_granularity_byte,
+		.base_high = (size_t)tss >> GDT_BASE_HIGH_OFFSET
+	};
+
+	return entry;
+}
+
+COLD
+static void gdt_populate (tss_t *tss, tss_t *fault_tss) {
 	const size_t s_null_i = 0;
 	const size_t s_code_i = GDT_SUPERVISOR_CODE_SELECTOR / sizeof(gdt_entry_t);
 	const size_t s_data_i = GDT_SUPERVISOR_DATA_SELECTOR / sizeof(gdt_entry_t);
 	const size_t u_code_i = GDT_USERSPACE_CODE_SELECTOR  / sizeof(gdt_entry_t);
 	const size_t u_data_i = GDT_USERSPACE_DATA_SELECTOR  / sizeof(gdt_entry_t);
 	const size_t s_tss_i  = GDT_SUPERVISOR_TSS_SELECTOR  / sizeof(gdt_entry_t);
+	const size_t f_tss_i  = GDT_FAULT_TSS_SELECTOR       / sizeof(gdt_entry_t);
 
 	gdtr.offset[s_null_i].null = GDT_NULL;
 
@@ -210,15 +227,8 @@ static void gdt_populate (tss_t *tss) {
 	gdtr.offset[u_data_i].data = gdtr.offset[s_data_i].data;
 	gdtr.offset[u_data_i].data.access.ring = gdt_ring_three;
 
-	gdtr.offset[s_tss_i].tss = (gdt_entry_tss_t){
-		.limit_low = sizeof(tss_t),
-		.base_low = (size_t)tss,
-		.access = GDT_TSS_ACCESS,
-		.limit_high = sizeof(tss_t) >> GDT_LIMIT_HIGH_OFFSET,
-		.size = gdt_32bit,
-		.granularity = gdt_granularity_byte,
-		.base_high = (size_t)tss >> GDT_BASE_HIGH_OFFSET
-	};
+	gdtr.offset[s_tss_i].tss = gdt_get_tss_entry (tss);
+	gdtr.offset[f_tss_i].tss = gdt_get_tss_entry (fault_tss);
 }
 
 COLD
@@ -235,9 +245,9 @@ static void gdt_load () {
 }
 
 COLD
-void gdt_init (tss_t *tss) {
-	// One NULL selector, a code and data selector for supervisor and userland, and one
-	// TSS selector.
+void gdt_init (tss_t *tss, tss_t *fault_tss) {
+	// One NULL selector, a code and data selector for supervisor and userland, and two
+	// TSS selectors.
 	gdtr.size = GDT_LENGTH - 1;
 
 	gdtr.offset = malloc (GDT_LENGTH);
@@ -246,7 +256,7 @@ void gdt_init (tss_t *tss) {
 		kpanic ();
 	}
 
-	gdt_populate (tss);
+	gdt_populate (tss, fault_tss);
 
 	gdt_load ();
 }
@@ -1,81 +1,52 @@
 // kernel/arch/x86/mm/paging.c
 
+#include <stdbool.h>
+
+#include <attributes.h>
+
+#include <asm/cpuid.h>
 #include <kprint/kprint.h>
 #include <kpanic/kpanic.h>
-#include <mm/freemem.h>
+#include <mm/buddy.h>
 #include <mm/page.h>
 #include <mm/paging.h>
+#include <mm/tlb.h>
 
 #define PAGE_TABLE_LENGTH     1024
 #define PAGE_DIRECTORY_LENGTH 1024
 
-static page_table_entry_t *paging_create_table () {
-	size_t i;
-	freemem_region_t page_table_region;
-	page_table_entry_t *page_table;
+// The directory paging was enabled with, which outlives the boot stack it came from.
+static paging_data_t paging_kernel_data = NULL;
 
-	page_table_region = freemem_alloc (
-		PAGE_TABLE_LENGTH * sizeof(page_table_entry_t), PAGE_SIZE, 0);
-	if (!page_table_region.length) {
-		kputs ("mm/paging: Failed to allocate a page table!\n");
-		kpanic ();
-	}
+static bool paging_large_pages = false;
 
-	page_table = page_table_region.p;
+#define CR4_PSE 0x10
 
-	for (i = 0; PAGE_TABLE_LENGTH > i; ++i) {
-		page_attrs_t attrs = {
-			.present = false,
-			.writable = false,
-			.user = false,
-			.write_through = false,
-			.cache_disabled = false,
-			.accessed = false,
-			.dirty = false,
-			.global = false
-		};
-
-		page_table_entry_logical_t logical_table_entry = {
-			.attrs = attrs,
-			.physical_page_offset = NULL
-		};
+CONSTRUCTOR
+static void paging_construct () {
+	paging_large_pages = cpuid_get_features_edx () & CPUID_FEATURE_EDX_PSE;
+}
 
-		page_table[i] = page_table_entry_encode (logical_table_entry);
+// Zeroed entries aren't present.
+static page_table_entry_t *paging_create_table () {
+	page_table_entry_t *page_table = buddy_alloc_zeroed (
+		buddy_get_order (PAGE_TABLE_LENGTH * sizeof(page_table_entry_t)));
+	if (!page_table) {
+		kputs ("mm/paging: Failed to allocate a page table!\n");
+		kpanic ();
 	}
 
 	return page_table;
 }
 
 static page_directory_entry_t *paging_create_directory () {
-	size_t i;
-	freemem_region_t page_directory_region;
-	page_directory_entry_t *page_directory;
-
-	page_directory_region = freemem_alloc (
-		PAGE_DIRECTORY_LENGTH * sizeof(page_directory_entry_t), PAGE_SIZE, 0);
-	if (!page_directory_region.length) {
+	page_directory_entry_t *page_directory = buddy_alloc_zeroed (
+		buddy_get_order (PAGE_DIRECTORY_LENGTH * sizeof(page_directory_entry_t)));
+	if (!page_directory) {
 		kputs ("mm/paging: Failed to allocate the page directory!\n");
 		kpanic ();
 	}
 
-	page_directory = page_directory_region.p;
-
-	for (i = 0; PAGE_TABLE_LENGTH > i; ++i) {
-		page_directory_entry_logical_t logical_directory_entry = {
-			.present = false,
-			.writable = false,
-			.user = false,
-			.write_through = false,
-			.cache_disabled = false,
-			.accessed = false,
-			.size = false,
-			.ignore = false,
-			.page_table_base = NULL
-		};
-
-		page_directory[i] = page_directory_entry_encode (logical_directory_entry);
-	}
-
 	return page_directory;
 }
 
@@ -114,6 +85,103 @@ static size_t paging_table_index (page_t *virtual) {
 	return (size_t)virtual / PAGE_SIZE % PAGE_TABLE_LENGTH;
 }
 
+static page_directory_entry_t paging_table_directory_entry (
+		page_table_entry_t *page_table
+) {
+	page_directory_entry_logical_t logical_entry = {
+		.present = true,
+		// Pages can be marked as not writable or not user accessible in the page table.
+		.writable = true,
+		.user = true,
+		.write_through = false,
+		.cache_disabled = false,
+		.accessed = false,
+		.size = false,
+		.ignore = false,
+		.page_table_base = page_table
+	};
+
+	return page_directory_entry_encode (logical_entry);
+}
+
+static page_directory_entry_t paging_large_entry_encode (
+		page_t *physical,
+		page_attrs_t attrs
+) {
+	page_directory_entry_logical_t logical_entry = {
+		.present         = attrs.present,
+		.writable        = attrs.writable,
+		.user            = attrs.user,
+		.write_through   = attrs.write_through,
+		.cache_disabled  = attrs.cache_disabled,
+		.accessed        = attrs.accessed,
+		.size            = true,
+		// For large pages this is the global bit.
+		.ignore          = attrs.global,
+		.page_table_base = (page_table_entry_t *)physical
+	};
+
+	page_directory_entry_t entry = page_directory_entry_encode (logical_entry);
+	// For large pages this is the dirty bit.
+	entry._rsv = attrs.dirty ? 0b1 : 0b0;
+
+	return entry;
+}
+
+static page_attrs_t paging_large_entry_attrs (page_directory_entry_t entry) {
+	page_directory_entry_logical_t logical_entry = page_directory_entry_decode (entry);
+
+	page_attrs_t attrs = {
+		.present        = logical_entry.present,
+		.writable       = logical_entry.writable,
+		.user           = logical_entry.user,
+		.write_through  = logical_entry.write_through,
+		.cache_disabled = logical_entry.cache_disabled,
+		.accessed       = logical_entry.accessed,
+		.dirty          = entry._rsv ? true : false,
+		.global         = logical_entry.ignore
+	};
+
+	return attrs;
+}
+
+// Physical page backing virtual within the large page of the directory entry.
+static page_t *paging_large_entry_map (page_directory_entry_t entry, page_t *virtual) {
+	page_directory_entry_logical_t logical_entry = page_directory_entry_decode (entry);
+
+	return (page_t *)logical_entry.page_table_base + paging_table_index (virtual);
+}
+
+// Replace a large page with a table mapping the same memory with the same attributes,
+// so that single pages within it can be changed.
+static void paging_split_large (
+		page_t *virtual,
+		page_directory_entry_t *directory_entry
+) {
+	size_t i;
+
+	const page_directory_entry_t large_entry = *directory_entry;
+	const page_attrs_t attrs = paging_large_entry_attrs (large_entry);
+	page_t *const physical = paging_large_entry_map (large_entry, NULL);
+
+	page_table_entry_t *page_table = paging_create_table ();
+
+	for (i = 0; PAGE_TABLE_LENGTH > i; ++i) {
+		page_table_entry_logical_t logical_table_entry = {
+			.attrs = attrs,
+			.physical_page_offset = physical + i
+		};
+
+		page_table[i] = page_table_entry_encode (logical_table_entry);
+	}
+
+	paging_atomic_write_directory (
+		directory_entry, paging_table_directory_entry (page_table));
+
+	// The translations are unchanged, but the processor may cache the large page.
+	tlb_flush_page (virtual);
+}
+
 static page_table_entry_t *paging_get_entries (
 		page_t *virtual,
 		page_directory_entry_t *directory,
@@ -130,16 +198,54 @@ static page_table_entry_t *paging_get_entries (
 	if (!directory_entry_logical.present)
 		return NULL;
 
+	if (directory_entry_logical.size) {
+		paging_split_large (virtual, *directory_entry_ptr);
+		directory_entry_logical = page_directory_entry_decode (**directory_entry_ptr);
+	}
+
 	return directory_entry_logical.page_table_base + table_index;
 }
 
+// As paging_get_entries, but returns NULL for large pages rather than splitting them.
+static page_table_entry_t *paging_peek_entries (
+		page_t *virtual,
+		page_directory_entry_t *directory,
+		page_directory_entry_t **directory_entry_ptr
+) {
+	*directory_entry_ptr = directory + paging_directory_index (virtual);
+
+	if (page_directory_entry_decode (**directory_entry_ptr).size)
+		return NULL;
+
+	return paging_get_entries (virtual, directory, directory_entry_ptr);
+}
+
+static bool paging_is_large (page_directory_entry_t *directory_entry) {
+	const page_directory_entry_logical_t directory_entry_logical =
+		page_directory_entry_decode (*directory_entry);
+
+	return directory_entry_logical.present && directory_entry_logical.size;
+}
+
 void paging_init (paging_data_t *page_directory_ptr) {
 	*page_directory_ptr = paging_create_directory ();
 }
 
 void paging_enable (paging_data_t *page_directory_ptr) {
+	paging_kernel_data = *page_directory_ptr;
+
 	paging_switch (page_directory_ptr);
 
+	if (paging_large_pages) {
+		asm volatile (
+			"mov		%%cr4,				%%eax;\n"
+			"or			%0,					%%eax;\n"
+			"mov		%%eax,				%%cr4;\n"
+			:
+			:"i"(CR4_PSE)
+			:"memory", "eax");
+	}
+
 	asm volatile (
 		"mov		%%cr0,				%%eax;\n"
 		"or			$0x80000000,		%%eax;\n"
@@ -148,9 +254,22 @@ void paging_enable (paging_data_t *page_directory_ptr) {
 		:
 		:"memory", "eax");
 
+	tlb_enable ();
+
 	kputs ("mm/paging: Paging enabled successfully.\n");
 }
 
+paging_data_t *paging_get_kernel_data () {
+	if (!paging_kernel_data)
+		return NULL;
+
+	return &paging_kernel_data;
+}
+
+bool paging_large_supported () {
+	return paging_large_pages;
+}
+
 void paging_switch (paging_data_t *page_directory_ptr) {
 	asm volatile (
 		"mov		%0,					%%cr3;\n"
@@ -161,7 +280,7 @@ void paging_switch (paging_data_t *page_directory_ptr) {
 
 bool paging_table_present (page_t *virtual, paging_data_t *page_directory_ptr) {
 	page_directory_entry_t *directory_entry;
-	paging_get_entries (virtual, *page_directory_ptr, &directory_entry);
+	paging_peek_entries (virtual, *page_directory_ptr, &directory_entry);
 
 	const page_directory_entry_logical_t directory_entry_logical =
 		page_directory_entry_decode (*directory_entry);
@@ -204,6 +323,9 @@ void paging_set_map (
 		page_table_entry_t table_entry_tmp =
 			page_table_entry_encode (table_entry_logical);
 		paging_atomic_write_table (table_entry, table_entry_tmp);
+
+		if (table_entry_logical.attrs.present)
+			tlb_flush_page (virtual);
 	}
 
 	if (write_directory) {
@@ -213,10 +335,41 @@ void paging_set_map (
 	}
 }
 
+void paging_set_large_map (
+		page_t *virtual,
+		page_t *physical,
+		page_attrs_t attrs,
+		paging_data_t *page_directory_ptr
+) {
+	if (!paging_large_pages) {
+		kputs ("mm/paging: Large pages are not supported!\n");
+		kpanic ();
+	}
+
+	if ((size_t)virtual % PAGE_LARGE_SIZE || (size_t)physical % PAGE_LARGE_SIZE) {
+		kputs ("mm/paging: Large page is not aligned!\n");
+		kpanic ();
+	}
+
+	page_directory_entry_t *directory_entry =
+		*page_directory_ptr + paging_directory_index (virtual);
+
+	if (page_directory_entry_decode (*directory_entry).present) {
+		kputs ("mm/paging: Attempt to map a large page over present mappings!\n");
+		kpanic ();
+	}
+
+	paging_atomic_write_directory (
+		directory_entry, paging_large_entry_encode (physical, attrs));
+}
+
 page_t *paging_get_map (page_t *virtual, paging_data_t *page_directory_ptr) {
 	page_directory_entry_t *directory_entry;
 	page_table_entry_t *table_entry =
-		paging_get_entries (virtual, *page_directory_ptr, &directory_entry);
+		paging_peek_entries (virtual, *page_directory_ptr, &directory_entry);
+
+	if (paging_is_large (directory_entry))
+		return paging_large_entry_map (*directory_entry, virtual);
 
 	if (!table_entry) {
 		kputs ("mm/paging: Failed to get mapping of page in non-present table!\n");
@@ -246,10 +399,15 @@ void paging_set_attrs (
 	page_table_entry_logical_t table_entry_logical =
 		page_table_entry_decode (*table_entry);
 
+	const bool was_present = table_entry_logical.attrs.present;
 	table_entry_logical.attrs = attrs;
 
 	page_table_entry_t table_entry_tmp = page_table_entry_encode (table_entry_logical);
 	paging_atomic_write_table (table_entry, table_entry_tmp);
+
+	// Entries which weren't present are never cached.
+	if (was_present)
+		tlb_flush_page (virtual);
 }
 
 page_attrs_t paging_get_attrs (
@@ -258,7 +416,10 @@ page_attrs_t paging_get_attrs (
 ) {
 	page_directory_entry_t *directory_entry;
 	page_table_entry_t *table_entry =
-		paging_get_entries (virtual, *page_directory_ptr, &directory_entry);
+		paging_peek_entries (virtual, *page_directory_ptr, &directory_entry);
+
+	if (paging_is_large (directory_entry))
+		return paging_large_entry_attrs (*directory_entry);
 
 	if (!table_entry) {
 		kputs ("mm/paging: Failed to set attributes of page in non-present table!\n");
@@ -271,6 +432,174 @@ page_attrs_t paging_get_attrs (
 	return table_entry_logical.attrs;
 }
 
+typedef enum paging_range_mode_enum {
+	paging_range_map,
+	paging_range_map_compatable,
+	paging_range_protect
+} paging_range_mode_t;
+
+// Table for the run of pages at virtual, creating one or splitting a large page if
+// needed.  Will return NULL when protecting pages without a table.
+static page_table_entry_t *paging_range_get_table (
+		page_t *virtual,
+		page_directory_entry_t *directory_entry,
+		paging_range_mode_t mode
+) {
+	page_directory_entry_logical_t directory_entry_logical =
+		page_directory_entry_decode (*directory_entry);
+
+	if (!directory_entry_logical.present) {
+		if (paging_range_protect == mode)
+			return NULL;
+
+		page_table_entry_t *page_table = paging_create_table ();
+		paging_atomic_write_directory (
+			directory_entry, paging_table_directory_entry (page_table));
+
+		return page_table + paging_table_index (virtual);
+	}
+
+	if (directory_entry_logical.size) {
+		paging_split_large (virtual, directory_entry);
+		directory_entry_logical = page_directory_entry_decode (*directory_entry);
+	}
+
+	return directory_entry_logical.page_table_base + paging_table_index (virtual);
+}
+
+// Rewrite a directory entry that covers the whole run as a large page, if possible.
+static bool paging_range_large (
+		page_directory_entry_t *directory_entry,
+		page_t *physical,
+		page_attrs_t attrs,
+		paging_range_mode_t mode
+) {
+	const page_directory_entry_logical_t directory_entry_logical =
+		page_directory_entry_decode (*directory_entry);
+	const bool is_large = directory_entry_logical.present && directory_entry_logical.size;
+
+	if (paging_range_protect == mode) {
+		if (!is_large)
+			return false;
+
+		physical = paging_large_entry_map (*directory_entry, NULL);
+	} else {
+		// Absent pages need a table, a non-present directory entry maps nothing.
+		if (!paging_large_pages || !attrs.present || (size_t)physical % PAGE_LARGE_SIZE)
+			return false;
+
+		if (directory_entry_logical.present && !is_large)
+			return false;
+
+		if (is_large && paging_range_map_compatable == mode)
+			attrs = paging_compatable_attrs (
+				attrs, paging_large_entry_attrs (*directory_entry));
+	}
+
+	paging_atomic_write_directory (
+		directory_entry, paging_large_entry_encode (physical, attrs));
+
+	return true;
+}
+
+static void paging_range (
+		page_t *virtual,
+		page_t *physical,
+		size_t count,
+		page_attrs_t attrs,
+		paging_range_mode_t mode,
+		paging_data_t *page_directory_ptr
+) {
+	// Entries which weren't present are never cached, only the rest are invalidated.
+	tlb_batch_t batch = new_tlb_batch ();
+
+	while (count) {
+		size_t i;
+		size_t run = PAGE_TABLE_LENGTH - paging_table_index (virtual);
+		if (run > count)
+			run = count;
+
+		page_directory_entry_t *directory_entry =
+			*page_directory_ptr + paging_directory_index (virtual);
+
+		if (PAGE_TABLE_LENGTH == run) {
+			const bool was_large = paging_is_large (directory_entry);
+
+			if (paging_range_large (directory_entry, physical, attrs, mode)) {
+				if (was_large)
+					tlb_batch_add_range (&batch, virtual, run);
+				goto next;
+			}
+		}
+
+		page_table_entry_t *table_entry =
+			paging_range_get_table (virtual, directory_entry, mode);
+		if (!table_entry) {
+			kputs ("mm/paging: Failed to set attributes of pages in non-present table!\n");
+			kpanic ();
+		}
+
+		for (i = 0; run > i; ++i) {
+			page_table_entry_logical_t table_entry_logical =
+				page_table_entry_decode (table_entry[i]);
+
+			if (table_entry_logical.attrs.present)
+				tlb_batch_add (&batch, virtual + i);
+
+			if (paging_range_map_compatable == mode)
+				table_entry_logical.attrs =
+					paging_compatable_attrs (attrs, table_entry_logical.attrs);
+			else
+				table_entry_logical.attrs = attrs;
+
+			if (paging_range_protect != mode)
+				table_entry_logical.physical_page_offset = physical + i;
+
+			paging_atomic_write_table (
+				table_entry + i, page_table_entry_encode (table_entry_logical));
+		}
+
+next:
+		virtual += run;
+		if (paging_range_protect != mode)
+			physical += run;
+		count -= run;
+	}
+
+	tlb_batch_flush (&batch);
+}
+
+void paging_map_range (
+		page_t *virtual,
+		page_t *physical,
+		size_t count,
+		page_attrs_t attrs,
+		paging_data_t *page_directory_ptr
+) {
+	paging_range (virtual, physical, count, attrs, paging_range_map, page_directory_ptr);
+}
+
+void paging_map_range_compatable (
+		page_t *virtual,
+		page_t *physical,
+		size_t count,
+		page_attrs_t attrs,
+		paging_data_t *page_directory_ptr
+) {
+	paging_range (
+		virtual, physical, count, attrs, paging_range_map_compatable,
+		page_directory_ptr);
+}
+
+void paging_protect_range (
+		page_t *virtual,
+		size_t count,
+		page_attrs_t attrs,
+		paging_data_t *page_directory_ptr
+) {
+	paging_range (virtual, NULL, count, attrs, paging_range_protect, page_directory_ptr);
+}
+
 page_attrs_t paging_compatable_attrs (page_attrs_t a, page_attrs_t b) {
 	page_attrs_t compatable = {
 		.present        = a.present        || b.present,
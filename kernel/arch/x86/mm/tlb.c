@@ -0,0 +1,148 @@
+// kernel/arch/x86/mm/tlb.c
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <attributes.h>
+
+#include <asm/cpuid.h>
+#include <asm/invlpg.h>
+#include <mm/page.h>
+#include <mm/tlb.h>
+
+#define CR4_PGE 0x80
+
+static bool tlb_global = false;
+static bool tlb_global_known = false;
+static bool tlb_enabled = false;
+
+static tlb_stats_t tlb_stats = {
+	.page_flushes = 0,
+	.full_flushes = 0,
+	.collapsed = 0
+};
+
+// Other constructors mark their attributes global, so this can't wait for one of its own.
+bool tlb_global_supported () {
+	if (!tlb_global_known) {
+		tlb_global = cpuid_get_features_edx () & CPUID_FEATURE_EDX_PGE;
+		tlb_global_known = true;
+	}
+
+	return tlb_global;
+}
+
+void tlb_enable () {
+	// Global pages may only be enabled once paging is.
+	if (tlb_global_supported ()) {
+		asm volatile (
+			"mov		%%cr4,				%%eax;\n"
+			"or			%0,					%%eax;\n"
+			"mov		%%eax,				%%cr4;\n"
+			:
+			:"i"(CR4_PGE)
+			:"memory", "eax");
+	}
+
+	tlb_enabled = true;
+}
+
+void tlb_flush_page (page_t *virtual) {
+	if (!tlb_enabled)
+		return;
+
+	invlpg (virtual);
+	tlb_stats.page_flushes += 1;
+}
+
+void tlb_flush_range (page_t *virtual, size_t count) {
+	size_t i;
+
+	if (TLB_BATCH_MAX < count) {
+		tlb_flush_all ();
+		tlb_stats.collapsed += count;
+		return;
+	}
+
+	for (i = 0; count > i; ++i)
+		tlb_flush_page (virtual + i);
+}
+
+void tlb_flush_all () {
+	if (!tlb_enabled)
+		return;
+
+	// Toggling PGE flushes everything, global pages included.
+	if (tlb_global) {
+		asm volatile (
+			"mov		%%cr4,				%%eax;\n"
+			"xor		%0,					%%eax;\n"
+			"mov		%%eax,				%%cr4;\n"
+			"xor		%0,					%%eax;\n"
+			"mov		%%eax,				%%cr4;\n"
+			:
+			:"i"(CR4_PGE)
+			:"memory", "eax");
+	} else {
+		asm volatile (
+			"mov		%%cr3,				%%eax;\n"
+			"mov		%%eax,				%%cr3;\n"
+			:
+			:
+			:"memory", "eax");
+	}
+
+	tlb_stats.full_flushes += 1;
+}
+
+void tlb_batch_add (tlb_batch_t *batch, page_t *virtual) {
+	if (batch->overflow) {
+		tlb_stats.collapsed += 1;
+		return;
+	}
+
+	if (TLB_BATCH_MAX == batch->count) {
+		batch->overflow = true;
+		tlb_stats.collapsed += batch->count + 1;
+		return;
+	}
+
+	batch->pages[batch->count++] = virtual;
+}
+
+void tlb_batch_add_range (tlb_batch_t *batch, page_t *virtual, size_t count) {
+	size_t i;
+
+	if (batch->overflow) {
+		tlb_stats.collapsed += count;
+		return;
+	}
+
+	if (TLB_BATCH_MAX - batch->count < count) {
+		tlb_stats.collapsed += batch->count + count;
+		batch->overflow = true;
+		return;
+	}
+
+	for (i = 0; count > i; ++i)
+		batch->pages[batch->count++] = virtual + i;
+}
+
+void tlb_batch_flush (tlb_batch_t *batch) {
+	size_t i;
+
+	if (batch->overflow) {
+		tlb_flush_all ();
+	} else {
+		for (i = 0; batch->count > i; ++i)
+			tlb_flush_page (batch->pages[i]);
+	}
+
+	*batch = new_tlb_batch ();
+}
+
+tlb_stats_t tlb_get_stats () {
+	return tlb_stats;
+}
+
+// vim: set ts=4 sw=4 noet syn=c:
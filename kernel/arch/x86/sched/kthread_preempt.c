@@ -26,9 +26,6 @@ FASTCALL
 static void kthread_pit_825x_irq0_hook (irq_t);
 FASTCALL FAST HOT
 static void kthread_pit_825x_irq0_hook (irq_t irq) {
-	if (native_lock_is_locked (kthread_preempt_lock))
-		return;
-
 	// If we can't obtain the exclusive lock, we return to the task because switching
 	// isn't safe or desirable for the currently running thread.
 	if (!kthread_lock_task ()) {
@@ -36,7 +33,11 @@ static void kthread_pit_825x_irq0_hook (irq_t irq) {
 		return;
 	}
 
-	kthread_yield ();
+	// Sleepers are woken even while preemption is disabled, they just wait to run.
+	kthread_wake_sleepers ();
+
+	if (!native_lock_is_locked (kthread_preempt_lock))
+		kthread_yield ();
 
 	kthread_unlock_task ();
 }
@@ -1,5 +1,7 @@
 // kernel/arch/x86/sched/tss.c
 
+#include <stdalign.h>
+
 #include <attributes.h>
 
 #include <kprint/kprint.h>
@@ -10,8 +12,12 @@
 #include <mm/malloc.h>
 
 static tss_t *tss_task_state_segment;
+static tss_t *tss_fault_task_state_segment;
 static void *tss_esp;
 
+// Reserved bit 1 is always set, interrupts are disabled.
+#define TSS_FAULT_EFLAGS 0x00000002
+
 COLD
 void tss_init (void *esp) {
 	tss_esp = esp;
@@ -26,13 +32,22 @@ void tss_init (void *esp) {
 		kpanic ();
 	}
 
-	tss_task_state_segment = malloc (sizeof(tss_t));
+	tss_task_state_segment = aligned_alloc (alignof(tss_t), sizeof(tss_t));
 	if (!tss_task_state_segment) {
 		kputs ("sched/tss: Failed to allocate TSS!\n");
 		kpanic ();
 	}
 
 	*tss_task_state_segment = tss_encode (logical_tss);
+
+	// Filled in by tss_set_fault_task once paging is ready.
+	tss_fault_task_state_segment = aligned_alloc (alignof(tss_t), sizeof(tss_t));
+	if (!tss_fault_task_state_segment) {
+		kputs ("sched/tss: Failed to allocate fault TSS!\n");
+		kpanic ();
+	}
+
+	*tss_fault_task_state_segment = new_tss ();
 }
 
 COLD
@@ -40,6 +55,34 @@ tss_t *tss_get () {
 	return tss_task_state_segment;
 }
 
+COLD
+tss_t *tss_get_fault () {
+	return tss_fault_task_state_segment;
+}
+
+COLD
+void tss_set_fault_task (void (*eip) (), void *esp, uint32_t cr3) {
+	tss_logical_t logical_tss = new_tss_logical ();
+
+	logical_tss.eip    = eip;
+	logical_tss.esp    = esp;
+	logical_tss.ebp    = esp;
+	logical_tss.cr3    = cr3;
+	logical_tss.eflags = TSS_FAULT_EFLAGS;
+	logical_tss.cs     = GDT_SUPERVISOR_CODE_SELECTOR;
+	logical_tss.ss     = GDT_SUPERVISOR_DATA_SELECTOR;
+	logical_tss.ds     = GDT_SUPERVISOR_DATA_SELECTOR;
+	logical_tss.es     = GDT_SUPERVISOR_DATA_SELECTOR;
+	logical_tss.fs     = GDT_SUPERVISOR_DATA_SELECTOR;
+	logical_tss.gs     = GDT_SUPERVISOR_DATA_SELECTOR;
+	logical_tss.iopb   = sizeof(tss_t);
+
+	*tss_fault_task_state_segment = tss_encode (logical_tss);
+
+	// cr3 is never saved on a task switch, only loaded when switching back.
+	tss_task_state_segment->cr3 = cr3;
+}
+
 COLD
 void tss_load (segment_selector_t tss_selector) {
 	asm volatile (
@@ -1,10 +1,12 @@
 // kernel/dev/dev.c
 
+#include <stdalign.h>
+
 #include <attributes.h>
 #include <collections/bintree.h>
 
 #include <sched/mutex.h>
-#include <mm/malloc.h>
+#include <mm/slab.h>
 #include <kprint/kprint.h>
 #include <kpanic/kpanic.h>
 #include <dev/dev.h>
@@ -12,6 +14,7 @@
 #include <dev/dev_driver.h>
 #include <mm/page.h>
 #include <mm/paging.h>
+#include <mm/tlb.h>
 
 // Many of these routines are unessesarily large, using SMALL to reduce bloat.
 
@@ -26,6 +29,9 @@ static bintree_maj_t
 	dev_maj_tree_base,
 	*dev_maj_tree = &dev_maj_tree_base;
 
+static kmem_cache_t *dev_maj_node_cache;
+static kmem_cache_t *dev_min_node_cache;
+
 static bintree_min_node_t *dev_get (dev_t dev, bintree_maj_node_t **maj_node_ptr) {
 	*maj_node_ptr = dev_maj_tree->search (dev_maj_tree, dev.maj);
 	if (!*maj_node_ptr || (size_t)dev.maj != (*maj_node_ptr)->orderby) {
@@ -48,7 +54,7 @@ static bintree_min_node_t *dev_get (dev_t dev, bintree_maj_node_t **maj_node_ptr
 
 SMALL
 static bintree_maj_node_t *dev_maj_add (dev_maj_t maj) {
-	bintree_maj_node_t *maj_node = malloc (sizeof(bintree_maj_node_t));
+	bintree_maj_node_t *maj_node = kmem_cache_alloc (dev_maj_node_cache);
 	if (!maj_node) {
 		kputs ("dev/dev_driver: Failed to allocate new major node!\n");
 		kpanic ();
@@ -69,12 +75,12 @@ static bintree_maj_node_t *dev_maj_add (dev_maj_t maj) {
 SMALL
 static void dev_maj_remove (bintree_maj_node_t *maj_node) {
 	dev_maj_tree->remove (dev_maj_tree, maj_node);
-	free (maj_node);
+	kmem_cache_free (dev_maj_node_cache, maj_node);
 }
 
 SMALL
 static bintree_min_node_t *dev_min_add (bintree_min_t *min_tree, dev_driver_t *driver) {
-	bintree_min_node_t *min_node = malloc (sizeof(bintree_min_node_t));
+	bintree_min_node_t *min_node = kmem_cache_alloc (dev_min_node_cache);
 	if (!min_node) {
 		kputs ("dev/dev_driver: Failed to allocate new minor node!\n");
 		kpanic ();
@@ -94,13 +100,28 @@ static bintree_min_node_t *dev_min_add (bintree_min_t *min_tree, dev_driver_t *d
 SMALL
 static void dev_min_remove (bintree_min_t *min_tree, bintree_min_node_t *min_node) {
 	min_tree->remove (min_tree, min_node);
-	free (min_node);
+	kmem_cache_free (dev_min_node_cache, min_node);
 }
 
 CONSTRUCTOR
 void dev_construct () {
 	dev_mutex_base = new_mutex ();
 	dev_maj_tree_base = new_bintree_maj ();
+
+	dev_maj_node_cache = kmem_cache_create (
+		"dev_maj",
+		sizeof(bintree_maj_node_t),
+		alignof(bintree_maj_node_t),
+		NULL);
+	dev_min_node_cache = kmem_cache_create (
+		"dev_min",
+		sizeof(bintree_min_node_t),
+		alignof(bintree_min_node_t),
+		NULL);
+	if (!dev_maj_node_cache || !dev_min_node_cache) {
+		kputs ("dev/dev_driver: Failed to create device node caches!\n");
+		kpanic ();
+	}
 }
 
 SMALL
@@ -179,30 +200,38 @@ void dev_map (dev_t dev, paging_data_t *paging_data) {
 
 	dev_driver_t *driver = min_node->data;
 
-	page_t *pg = NULL;
-	bool need_write;
-	while ((pg = driver->next_page_mapping (driver, pg, &need_write))) {
+	// Contiguous pages with the same attributes are mapped as a single run.
+	page_t *pg = NULL, *run = NULL;
+	size_t run_length = 0;
+	bool need_write, run_need_write = false;
+	do {
+		pg = driver->next_page_mapping (driver, pg, &need_write);
+
+		if (run_length && (!pg || run + run_length != pg || run_need_write != need_write)) {
 #if !defined(IZIX) || defined(ARCH_X86)
-		page_attrs_t compat_attrs = {
-			.present = true,
-			.writable = need_write,
-			.user = false,
-			.write_through = true,
-			.cache_disabled = true,
-			.accessed = false,
-			.dirty = false,
-			.global = false
-		};
+			page_attrs_t attrs = {
+				.present = true,
+				.writable = run_need_write,
+				.user = false,
+				.write_through = true,
+				.cache_disabled = true,
+				.accessed = false,
+				.dirty = false,
+				.global = tlb_global_supported ()
+			};
 #endif
 
-		if (paging_table_present (pg, paging_data)) {
-			page_attrs_t old_attrs = paging_get_attrs (pg, paging_data);
-			compat_attrs = paging_compatable_attrs (compat_attrs, old_attrs);
+			paging_map_range_compatable (run, run, run_length, attrs, paging_data);
+			run_length = 0;
 		}
 
-		paging_set_map (pg, pg, paging_data);
-		paging_set_attrs (pg, compat_attrs, paging_data);
-	}
+		if (pg && !run_length) {
+			run = pg;
+			run_need_write = need_write;
+		}
+		if (pg)
+			++run_length;
+	} while (pg);
 
 	mutex_release (dev_mutex);
 }
@@ -0,0 +1,47 @@
+// kernel/include/mm/buddy.h
+
+#ifndef IZIX_BUDDY_H
+#define IZIX_BUDDY_H 1
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <attributes.h>
+
+#include <mm/freemem.h>
+
+// Blocks are 2^order pages, the largest being 4MiB.
+#define BUDDY_MAX_ORDER 10
+// Each region added gets its own zone, with the page metadata in its first pages.
+#define BUDDY_MAX_ZONES 16
+
+// The region is trimmed to whole pages.  Will return false if there are no zones left
+// or if the region is too small to be worth managing, the caller keeps the memory.
+bool buddy_add_region (freemem_region_t);
+
+// Will return NULL if order is larger than BUDDY_MAX_ORDER or no memory is available.
+void *buddy_alloc (size_t)
+	MALLOC;
+// Never waits for the lock, will also return NULL if it is held.  For use where yielding
+// is impossible.
+void *buddy_try_alloc (size_t)
+	MALLOC;
+// As buddy_alloc and buddy_try_alloc, but the block is zeroed.  Single pages are taken
+// from a pool zeroed while idle where possible.
+void *buddy_alloc_zeroed (size_t)
+	MALLOC;
+void *buddy_try_alloc_zeroed (size_t)
+	MALLOC;
+// Zero one more page into the pool, never waits for the lock.  Returns false if there was
+// nothing to do.
+bool buddy_fill_zeroed ();
+// The order must be the same as the one the block was allocated with.
+void buddy_free (void *, size_t);
+// Return true if the pointer lies within a zone managed by the buddy allocator.
+bool buddy_owns (const void *);
+// The smallest order whose blocks can hold length bytes.
+size_t buddy_get_order (size_t);
+
+#endif
+
+// vim: set ts=4 sw=4 noet syn=c:
@@ -6,6 +6,8 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+#include <mm/mm_stats.h>
+
 typedef struct freemem_region_struct {
 	void *p;
 	size_t length;
@@ -28,10 +30,40 @@ static inline void *freemem_region_end (freemem_region_t region) {
 void freemem_init (void *, size_t);
 
 bool freemem_add_region (freemem_region_t);
+// Only for the first regions, the tree must be empty.  The regions must be sorted,
+// disjoint and not touching, and there must be a node in the initial pool for each.
+void freemem_build (const freemem_region_t *, size_t);
 bool freemem_remove_region (freemem_region_t);
 // The absolute value of offset must be less than alignment.
 // Will return zeroed if a region cannot be found.
 freemem_region_t freemem_alloc (size_t, size_t, int);
+// As freemem_alloc, but the region is zeroed.
+freemem_region_t freemem_alloc_zeroed (size_t, size_t, int);
+// Grow an allocated region to length using the free regions on either side of it, moving
+// its start down to the alignment if needed.  Returns the new region, which may be longer
+// than length if the start moved, or zeroed if there isn't room, in which case the region
+// is unchanged.  The contents are not moved.
+freemem_region_t freemem_extend (freemem_region_t, size_t, size_t);
+
+#ifdef IZIX_MM_STATS
+typedef struct freemem_stats_struct {
+	size_t regions;
+	size_t free_bytes;
+	size_t largest;
+	size_t histogram[MM_STATS_BUCKETS];
+	// The region node pool.
+	size_t chunks;
+	size_t nodes_used;
+	size_t nodes_free;
+	// Most nodes visited by a single search for a region.
+	size_t suggest_worst_steps;
+	// Sites of freemem_alloc and freemem_remove_region, and of freemem_add_region.
+	mm_stats_sites_t sites;
+} freemem_stats_t;
+
+void freemem_get_stats (freemem_stats_t *);
+void freemem_dump_stats ();
+#endif
 
 #endif
 
@@ -0,0 +1,33 @@
+// kernel/include/mm/kmalloc.h
+
+#ifndef IZIX_KMALLOC_H
+#define IZIX_KMALLOC_H 1
+
+#include <stddef.h>
+
+#include <attributes.h>
+
+typedef unsigned int kmalloc_flags_t;
+
+#define KMALLOC_NORMAL 0b00
+// Never waits or yields, for interrupt handlers and code holding the task lock.  Only
+// sizes up to KMALLOC_ATOMIC_MAX_SIZE can be allocated, from a reserve kept topped up by
+// a background kthread, and NULL is returned if the reserve has run out.
+#define KMALLOC_ATOMIC 0b01
+#define KMALLOC_ZERO   0b10
+
+#define KMALLOC_ATOMIC_MIN_SIZE 32
+#define KMALLOC_ATOMIC_MAX_SIZE 1024
+
+// Must be called after kthreads are initialized, atomic allocations fail until then.
+void kmalloc_init ();
+
+void *kmalloc (size_t, kmalloc_flags_t)
+	MALLOC;
+// With KMALLOC_ATOMIC the memory is handed to the background kthread to free.  Works for
+// anything from malloc, not only atomic allocations.
+void kfree (void *, kmalloc_flags_t);
+
+#endif
+
+// vim: set ts=4 sw=4 noet syn=c:
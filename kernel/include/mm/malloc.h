@@ -8,6 +8,8 @@
 
 #include <attributes.h>
 
+#include <mm/mm_stats.h>
+
 #ifdef _GCC_MAX_ALIGN_T
 typedef max_align_t __malloc_max_align_t;
 #else
@@ -18,14 +20,43 @@ typedef struct {
 #endif
 
 // 8-or-so really isn't enough to fit many data structures into, 64-or-so is much better.
+// The TLSF backend only aligns to TLSF_ALIGNMENT.
 #define MALLOC_ALIGNMENT (alignof(__malloc_max_align_t) * alignof(__malloc_max_align_t))
 
 void *malloc (size_t)
 	MALLOC;
+void *calloc (size_t, size_t)
+	MALLOC;
 void *realloc (void *, size_t)
 	MALLOC;
 void free (void *);
 
+// Without a header, the caller gives the size back to free_sized instead.  The alignment
+// must be a power of two.  The pointer must only be freed with free_sized, and with the
+// size it was allocated with.
+void *aligned_alloc (size_t, size_t)
+	MALLOC;
+void free_sized (void *, size_t);
+
+// The TLSF backend has no statistics of its own.
+#if defined(IZIX_MM_STATS) && !defined(IZIX_MALLOC_TLSF)
+typedef struct malloc_stats_struct {
+	// Allocations with a header and their own region, and the length of those regions.
+	size_t regions;
+	size_t region_bytes;
+	// Every region carries MALLOC_ALIGNMENT of header.
+	size_t header_bytes;
+	// Rounding of every region allocated so far, excluding the header.
+	size_t padding_bytes;
+	// Sites of malloc, calloc, aligned_alloc, free and free_sized.  Calls made by realloc
+	// count as realloc's own.
+	mm_stats_sites_t sites;
+} malloc_stats_t;
+
+void malloc_get_stats (malloc_stats_t *);
+void malloc_dump_stats ();
+#endif
+
 #endif
 
 // vim: set ts=4 sw=4 noet syn=c:
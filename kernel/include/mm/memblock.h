@@ -0,0 +1,26 @@
+// kernel/include/mm/memblock.h
+
+#ifndef IZIX_MEMBLOCK_H
+#define IZIX_MEMBLOCK_H 1
+
+#include <stddef.h>
+
+#include <mm/freemem.h>
+
+// The early boot allocator.  Usable memory is added from the firmware's map in any
+// order and merged into sorted, disjoint ranges, whatever is already in use is reserved,
+// and boot time allocations are then carved off the front of the lowest range which
+// fits.  Once boot is done with it everything left is handed to the buddy allocator and
+// built into freemem in a single pass.
+
+#define MEMBLOCK_MAX_REGIONS 32
+
+void memblock_add (freemem_region_t);
+void memblock_reserve (freemem_region_t);
+// Returns NULL if no range fits.  The alignment must be a power of two.
+void *memblock_alloc (size_t, size_t);
+void memblock_release ();
+
+#endif
+
+// vim: set ts=4 sw=4 noet syn=c:
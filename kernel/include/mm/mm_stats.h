@@ -0,0 +1,45 @@
+// kernel/include/mm/mm_stats.h
+
+#ifndef IZIX_MM_STATS_H
+#define IZIX_MM_STATS_H 1
+
+// Allocator instrumentation, only built with MM_STATS=true which defines IZIX_MM_STATS.
+#ifdef IZIX_MM_STATS
+
+#include <stddef.h>
+
+// Sites past this many are all counted in the last slot, which has a NULL site.
+#define MM_STATS_SITES 32
+// Bucket i counts lengths of at least 2^i and less than 2^(i+1).
+#define MM_STATS_BUCKETS (8 * sizeof(size_t))
+
+// Must be used directly in the function whose caller is wanted.
+#define MM_STATS_CALLER() __builtin_return_address (0)
+
+typedef struct mm_stats_site_struct {
+	const void *site;
+	size_t allocs;
+	size_t alloc_bytes;
+	size_t frees;
+	size_t free_bytes;
+} mm_stats_site_t;
+
+typedef struct mm_stats_sites_struct {
+	mm_stats_site_t sites[MM_STATS_SITES];
+	size_t count;
+} mm_stats_sites_t;
+
+// Callers serialize access to the sites themselves.
+void mm_stats_record_alloc (mm_stats_sites_t *, const void *, size_t);
+void mm_stats_record_free (mm_stats_sites_t *, const void *, size_t);
+size_t mm_stats_get_bucket (size_t);
+
+// Each line is prefixed with the name.
+void mm_stats_dump_sites (const char *, const mm_stats_sites_t *);
+void mm_stats_dump_histogram (const char *, const size_t *);
+
+#endif
+
+#endif
+
+// vim: set ts=4 sw=4 noet syn=c:
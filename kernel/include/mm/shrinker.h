@@ -0,0 +1,32 @@
+// kernel/include/mm/shrinker.h
+
+#ifndef IZIX_SHRINKER_H
+#define IZIX_SHRINKER_H 1
+
+#include <stddef.h>
+
+// Caches register a shrinker so the memory they hold on to can be taken back when the
+// buddy allocator runs out.  Shrinkers are called from allocation paths with other
+// subsystems' locks held, so they must never wait for a lock which may be held while
+// allocating, and should skip whatever is busy instead.
+
+#define SHRINKER_MAX 8
+
+typedef struct shrinker_struct {
+	const char *name;
+	// Bytes which could be given back right now.
+	size_t (*count) ();
+	// Give back at least the bytes asked for if possible, returns the bytes given back.
+	size_t (*reclaim) (size_t);
+} shrinker_t;
+
+// Usually called from a constructor.  The shrinker must outlive the kernel.
+void shrinker_register (const shrinker_t *);
+size_t shrinker_count ();
+// Calls the shrinkers in the order they were registered until enough is given back.
+// Returns zero at once if reclaim is already in progress.
+size_t shrinker_reclaim (size_t);
+
+#endif
+
+// vim: set ts=4 sw=4 noet syn=c:
@@ -0,0 +1,42 @@
+// kernel/include/mm/slab.h
+
+#ifndef IZIX_SLAB_H
+#define IZIX_SLAB_H 1
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <attributes.h>
+
+// Most caches are created before the first allocation, often from a constructor.
+#define KMEM_CACHE_MAX 32
+
+typedef struct slab_cache_struct kmem_cache_t;
+typedef void (*kmem_cache_ctor_t) (void *);
+
+// Power-of-two size classes, SLAB_MIN_SIZE through SLAB_MAX_SIZE inclusive.
+#define SLAB_MIN_SIZE 16
+#define SLAB_MAX_SIZE 2048
+
+// Will return NULL if size is zero, larger than SLAB_MAX_SIZE or no memory is available.
+void *slab_alloc (size_t)
+	MALLOC;
+// The pointer must have been returned by slab_alloc.
+void slab_free (void *);
+// Return true if the pointer lies within memory managed by the slab allocator.
+bool slab_owns (const void *);
+// The size of the class the object was allocated from.
+size_t slab_get_size (const void *);
+
+// Does not allocate any memory, so caches may be created before freemem is initialized.
+// The name must outlive the cache.  Will return NULL if no more caches can be created,
+// or if one object would not fit in a page.
+kmem_cache_t *kmem_cache_create (const char *, size_t, size_t, kmem_cache_ctor_t);
+// The constructor, if any, is run on every object returned.
+void *kmem_cache_alloc (kmem_cache_t *)
+	MALLOC;
+void kmem_cache_free (kmem_cache_t *, void *);
+
+#endif
+
+// vim: set ts=4 sw=4 noet syn=c:
@@ -0,0 +1,36 @@
+// kernel/include/mm/tlsf.h
+
+#ifndef IZIX_TLSF_H
+#define IZIX_TLSF_H 1
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <attributes.h>
+
+// Two-level segregated fit heap.  Free blocks are kept in lists by size class, with a
+// bitmap of non-empty lists per class and of non-empty classes, so allocating and freeing
+// take constant time.  Calls never yield and run with interrupts disabled, so both may
+// be made from interrupt handlers.
+
+#define TLSF_ALIGNMENT 8
+// Larger blocks than fit in a buddy block aren't needed.
+#define TLSF_MAX_SIZE ((size_t)1 << 22)
+
+// Pools must be TLSF_ALIGNMENT aligned and are never given back.  Will return false if
+// the pool is too small or too large to hold a block.
+bool tlsf_add_pool (void *, size_t);
+// The length of a pool which is certain to fit an allocation of size.
+size_t tlsf_get_pool_size (size_t);
+
+// Will return NULL if size is zero, larger than TLSF_MAX_SIZE or no block is free.
+void *tlsf_alloc (size_t)
+	MALLOC;
+// The pointer must have been returned by tlsf_alloc.
+void tlsf_free (void *);
+// The usable size of the block, at least what was asked for.
+size_t tlsf_get_size (const void *);
+
+#endif
+
+// vim: set ts=4 sw=4 noet syn=c:
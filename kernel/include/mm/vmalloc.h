@@ -0,0 +1,41 @@
+// kernel/include/mm/vmalloc.h
+
+#ifndef IZIX_VMALLOC_H
+#define IZIX_VMALLOC_H 1
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <attributes.h>
+
+// Virtually contiguous allocations are built from single pages mapped into a window of
+// the kernel address space, so they don't need contiguous physical memory.
+#define VMALLOC_START ((void *)0xd0000000)
+#define VMALLOC_END   ((void *)0xe0000000)
+
+// Must be called after paging is enabled, vmalloc will return NULL until then.
+void vmalloc_init ();
+bool vmalloc_is_init ();
+
+// Will return NULL if size is zero or no memory is available.
+void *vmalloc (size_t)
+	MALLOC;
+// As vmalloc, but the pages are zeroed.
+void *vzalloc (size_t)
+	MALLOC;
+// Only reserves the area, each page is backed with a zeroed page when first touched.
+void *vmalloc_lazy (size_t)
+	MALLOC;
+// Grows in place by mapping pages at the tail when the window allows, otherwise the
+// pages are mapped again elsewhere in the window.  Nothing is ever copied.  Will return
+// NULL on failure, leaving the allocation as it was, and always for lazy areas.
+void *vrealloc (void *, size_t);
+void vfree (void *);
+// Return true if the pointer lies within the vmalloc window.
+bool vmalloc_owns (const void *);
+// The size actually mapped, always a multiple of PAGE_SIZE.
+size_t vmalloc_get_size (const void *);
+
+#endif
+
+// vim: set ts=4 sw=4 noet syn=c:
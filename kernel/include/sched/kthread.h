@@ -12,20 +12,53 @@
 #include <sched/spinlock.h>
 #include <sched/kthread_kpid.h>
 #include <sched/kthread_task.h>
+#include <time/time.h>
+#include <time/clock.h>
 
 #define KTHREAD_MAX_PROCS 256
 #define KTHREAD_STACK_SIZE (8 * PAGE_SIZE)
 
+// Runnable threads of a higher priority always run before those of a lower one, threads
+// of the same priority take turns.  No more than the bits in an unsigned int.
+#define KTHREAD_PRIORITIES       8
+#define KTHREAD_PRIORITY_MIN     0
+#define KTHREAD_PRIORITY_DEFAULT 3
+#define KTHREAD_PRIORITY_MAX     (KTHREAD_PRIORITIES - 1)
+
+typedef unsigned char kthread_priority_t;
+
+// Threads at KTHREAD_PRIORITY_FAIR don't take turns, the one which has run the least
+// virtual time runs next.  Virtual time is run time scaled down by the thread's weight,
+// which is a quarter less for every step of niceness, so threads share the CPU in
+// proportion to their weights no matter how early they yield.
+#define KTHREAD_PRIORITY_FAIR KTHREAD_PRIORITY_DEFAULT
+
+#define KTHREAD_NICE_MIN     -20
+#define KTHREAD_NICE_DEFAULT 0
+#define KTHREAD_NICE_MAX     19
+
+typedef signed char kthread_nice_t;
+
 void kthread_init (freemem_region_t);
 bool kthread_is_init ();
 void kthread_end_task ()
 	NORETURN;
 void kthread_yield ();
+// As kthread_yield, for a thread waiting on a lock held by another.  Runnable threads of
+// other priorities go first, even lower ones, so a holder among them isn't starved.
+void kthread_yield_contended ();
 // Return is true if kpid was blocking, false otherwise (even if kpid is free).
 bool kthread_wake (kpid_t);
 void kthread_block ();
-kpid_t kthread_new_task (void (*) ());
-kpid_t kthread_new_blocking_task (void (*) ());
+// Block until the time since boot, as clock_get_boot_time, has passed.  May return
+// sooner if kpid is woken with kthread_wake.
+void kthread_sleep_until (time_t);
+void kthread_sleep_for (time_t);
+// Wake every thread whose sleep is over.  Called on every clock tick and while idle.
+// Task must already be locked!
+void kthread_wake_sleepers ();
+kpid_t kthread_new_task (void (*) (), kthread_priority_t);
+kpid_t kthread_new_blocking_task (void (*) (), kthread_priority_t);
 kpid_t kthread_new_main_task ();
 
 /* Locking manipulates a semaphore that increments every time a lock is called decremented
@@ -39,6 +72,13 @@ bool kthread_lock_task ();
 void kthread_unlock_task ();
 
 kpid_t kthread_get_running_kpid ();
+// Takes effect the next time the thread is queued to run.  Return is false if the kpid
+// isn't a live thread or the priority is out of range.
+bool kthread_set_priority (kpid_t, kthread_priority_t);
+// As kthread_set_priority, but only changes the weight at KTHREAD_PRIORITY_FAIR.
+bool kthread_set_nice (kpid_t, kthread_nice_t);
+// Microseconds the thread has run for, or zero if kpid isn't a live thread.
+clock_t kthread_get_runtime (kpid_t);
 
 #endif
 
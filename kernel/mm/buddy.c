@@ -0,0 +1,349 @@
+// kernel/mm/buddy.c
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <attributes.h>
+#include <collections/linked_list.h>
+
+#include <asm/stos.h>
+#include <asm/toggle_int.h>
+#include <kprint/kprint.h>
+#include <kpanic/kpanic.h>
+#include <mm/buddy.h>
+#include <mm/freemem.h>
+#include <mm/page.h>
+#include <mm/shrinker.h>
+#include <sched/spinlock.h>
+
+// Binary buddy allocator for whole pages.  Free blocks are kept in one list per order,
+// with the list node living in the first page of the block itself.  A block's buddy is
+// found by flipping the order bit of its page number, so blocks are naturally aligned.
+// One byte per page records the order of a free block at its first page, which is all
+// that is needed to decide whether a buddy can be coalesced with.
+
+#define BUDDY_PAGE_FREE 0x80
+
+// Pages zeroed ahead of time by the idle task.
+#define BUDDY_ZEROED_PAGES 32
+
+typedef struct buddy_zone_struct {
+	// Page number of the first managed page.
+	size_t start;
+	size_t count;
+	uint8_t *pages;
+} buddy_zone_t;
+
+static linked_list_t buddy_free_lists[BUDDY_MAX_ORDER + 1];
+
+static buddy_zone_t buddy_zones[BUDDY_MAX_ZONES];
+static size_t buddy_zone_count = 0;
+
+static spinlock_t
+	buddy_lock_base,
+	*buddy_lock = &buddy_lock_base;
+
+// Taken from by the fault task too, so it is only touched with interrupts disabled.
+static page_t *buddy_zeroed[BUDDY_ZEROED_PAGES];
+static size_t buddy_zeroed_count = 0;
+
+static size_t buddy_get_page_number (const void *ptr) {
+	return (size_t)ptr / PAGE_SIZE;
+}
+
+static page_t *buddy_get_page (size_t page_number) {
+	return (page_t *)(page_number * PAGE_SIZE);
+}
+
+static buddy_zone_t *buddy_get_zone (size_t page_number) {
+	size_t i;
+
+	for (i = 0; buddy_zone_count > i; ++i) {
+		buddy_zone_t *zone = &buddy_zones[i];
+
+		if (zone->start <= page_number && zone->start + zone->count > page_number)
+			return zone;
+	}
+
+	return NULL;
+}
+
+static void buddy_push (buddy_zone_t *zone, size_t page_number, size_t order) {
+	linked_list_node_t *node = (linked_list_node_t *)buddy_get_page (page_number);
+
+	*node = new_linked_list_node ();
+	buddy_free_lists[order].push (&buddy_free_lists[order], node);
+
+	zone->pages[page_number - zone->start] = BUDDY_PAGE_FREE | order;
+}
+
+static void buddy_unlink (buddy_zone_t *zone, size_t page_number, size_t order) {
+	linked_list_node_t *node = (linked_list_node_t *)buddy_get_page (page_number);
+
+	buddy_free_lists[order].removeNode (&buddy_free_lists[order], node);
+
+	zone->pages[page_number - zone->start] = 0;
+}
+
+// Is the buddy of this block entirely within the zone and free at the same order.
+static bool buddy_is_free (buddy_zone_t *zone, size_t buddy_number, size_t order) {
+	if (zone->start > buddy_number ||
+			zone->start + zone->count < buddy_number + (1 << order))
+		return false;
+
+	return (BUDDY_PAGE_FREE | order) == zone->pages[buddy_number - zone->start];
+}
+
+CONSTRUCTOR
+static void buddy_construct () {
+	size_t i;
+
+	buddy_lock_base = new_spinlock ();
+
+	for (i = 0; BUDDY_MAX_ORDER >= i; ++i)
+		buddy_free_lists[i] = new_linked_list ();
+}
+
+bool buddy_add_region (freemem_region_t region) {
+	size_t start = buddy_get_page_number (region.p + PAGE_SIZE - 1);
+	const size_t end = buddy_get_page_number (freemem_region_end (region));
+
+	// Metadata takes a byte for every page, and must leave something to manage.
+	if (start + 2 > end)
+		return false;
+
+	const size_t meta_count = (end - start + PAGE_SIZE) / (PAGE_SIZE + 1);
+	uint8_t *const pages = (uint8_t *)buddy_get_page (start);
+
+	start += meta_count;
+
+	spinlock_lock (buddy_lock);
+
+	if (BUDDY_MAX_ZONES == buddy_zone_count) {
+		spinlock_release (buddy_lock);
+		return false;
+	}
+
+	buddy_zone_t *zone = &buddy_zones[buddy_zone_count++];
+
+	*zone = (buddy_zone_t){
+		.start = start,
+		.count = end - start,
+		.pages = pages
+	};
+
+	size_t i;
+	for (i = 0; zone->count > i; ++i)
+		pages[i] = 0;
+
+	// Carve the zone into the largest naturally aligned blocks that fit.
+	while (end > start) {
+		size_t order = BUDDY_MAX_ORDER;
+
+		while (start % (1 << order) || start + (1 << order) > end)
+			order -= 1;
+
+		buddy_push (zone, start, order);
+
+		start += 1 << order;
+	}
+
+	spinlock_release (buddy_lock);
+
+	return true;
+}
+
+// The lock must be held, and is released before returning.
+static void *buddy_alloc_locked (size_t order) {
+	size_t i;
+	linked_list_node_t *node = NULL;
+
+	for (i = order; BUDDY_MAX_ORDER >= i; ++i) {
+		node = buddy_free_lists[i].peek (&buddy_free_lists[i]);
+		if (node)
+			break;
+	}
+
+	if (!node) {
+		spinlock_release (buddy_lock);
+		return NULL;  // ENOMEM
+	}
+
+	const size_t page_number = buddy_get_page_number (node);
+	buddy_zone_t *zone = buddy_get_zone (page_number);
+
+	buddy_unlink (zone, page_number, i);
+
+	// Give back the upper halves until the block is the right size.
+	while (order < i) {
+		i -= 1;
+		buddy_push (zone, page_number + (1 << i), i);
+	}
+
+	spinlock_release (buddy_lock);
+
+	return node;
+}
+
+static page_t *buddy_zeroed_pop () {
+	page_t *page = NULL;
+
+	const bool int_enabled = int_is_enabled ();
+	disable_int ();
+	if (buddy_zeroed_count) {
+		buddy_zeroed_count -= 1;
+		page = buddy_zeroed[buddy_zeroed_count];
+	}
+	if (int_enabled)
+		enable_int ();
+
+	return page;
+}
+
+static size_t buddy_zeroed_count_bytes () {
+	return buddy_zeroed_count * PAGE_SIZE;
+}
+
+static size_t buddy_zeroed_reclaim (size_t length) {
+	size_t reclaimed = 0;
+
+	while (length > reclaimed) {
+		page_t *page = buddy_zeroed_pop ();
+		if (!page)
+			break;
+
+		buddy_free (page, 0);
+		reclaimed += PAGE_SIZE;
+	}
+
+	return reclaimed;
+}
+
+static const shrinker_t buddy_zeroed_shrinker = {
+	.name = "buddy_zeroed",
+	.count = buddy_zeroed_count_bytes,
+	.reclaim = buddy_zeroed_reclaim
+};
+
+CONSTRUCTOR
+static void buddy_zeroed_construct () {
+	shrinker_register (&buddy_zeroed_shrinker);
+}
+
+static void buddy_zero (void *block, size_t order) {
+	stosl (block, 0, ((size_t)PAGE_SIZE << order) / sizeof(uint32_t));
+}
+
+void *buddy_alloc (size_t order) {
+	if (BUDDY_MAX_ORDER < order)
+		return NULL;
+
+	spinlock_lock (buddy_lock);
+
+	void *block = buddy_alloc_locked (order);
+
+	// Caches may be holding on to enough, though it may not be contiguous.
+	if (!block && shrinker_reclaim ((size_t)PAGE_SIZE << order)) {
+		spinlock_lock (buddy_lock);
+		block = buddy_alloc_locked (order);
+	}
+
+	return block;
+}
+
+void *buddy_try_alloc (size_t order) {
+	if (BUDDY_MAX_ORDER < order || !spinlock_try_lock (buddy_lock))
+		return NULL;
+
+	return buddy_alloc_locked (order);
+}
+
+void *buddy_alloc_zeroed (size_t order) {
+	void *block = order ? NULL : buddy_zeroed_pop ();
+
+	if (!block) {
+		block = buddy_alloc (order);
+		if (block)
+			buddy_zero (block, order);
+	}
+
+	return block;
+}
+
+void *buddy_try_alloc_zeroed (size_t order) {
+	void *block = order ? NULL : buddy_zeroed_pop ();
+
+	if (!block) {
+		block = buddy_try_alloc (order);
+		if (block)
+			buddy_zero (block, order);
+	}
+
+	return block;
+}
+
+// Only the idle task fills the pool, everything else only takes from it, so the pool
+// can't become full between the check and the push.
+bool buddy_fill_zeroed () {
+	if (BUDDY_ZEROED_PAGES <= buddy_zeroed_count)
+		return false;
+
+	page_t *page = buddy_try_alloc (0);
+	if (!page)
+		return false;
+
+	buddy_zero (page, 0);
+
+	const bool int_enabled = int_is_enabled ();
+	disable_int ();
+	buddy_zeroed[buddy_zeroed_count] = page;
+	buddy_zeroed_count += 1;
+	if (int_enabled)
+		enable_int ();
+
+	return true;
+}
+
+void buddy_free (void *ptr, size_t order) {
+	size_t page_number = buddy_get_page_number (ptr);
+
+	spinlock_lock (buddy_lock);
+
+	buddy_zone_t *zone = buddy_get_zone (page_number);
+	if (!zone || BUDDY_MAX_ORDER < order || page_number % (1 << order)) {
+		kputs ("mm/buddy: Attempted to free an invalid block!\n");
+		kpanic ();
+	}
+
+	while (BUDDY_MAX_ORDER > order) {
+		const size_t buddy_number = page_number ^ (1 << order);
+
+		if (!buddy_is_free (zone, buddy_number, order))
+			break;
+
+		buddy_unlink (zone, buddy_number, order);
+
+		page_number &= ~(size_t)(1 << order);
+		order += 1;
+	}
+
+	buddy_push (zone, page_number, order);
+
+	spinlock_release (buddy_lock);
+}
+
+bool buddy_owns (const void *ptr) {
+	return buddy_get_zone (buddy_get_page_number (ptr));
+}
+
+size_t buddy_get_order (size_t length) {
+	size_t order = 0;
+
+	while ((size_t)PAGE_SIZE << order < length)
+		order += 1;
+
+	return order;
+}
+
+// vim: set ts=4 sw=4 noet syn=c:
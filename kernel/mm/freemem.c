@@ -1,14 +1,20 @@
 // kernel/mm/freemem.c
 
+#include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <attributes.h>
 #include <collections/bintree.h>
+#include <collections/linked_list.h>
 #include <collections/sparse_collection.h>
+#include <string.h>
 
 #include <kprint/kprint.h>
 #include <kpanic/kpanic.h>
 #include <mm/freemem.h>
+#include <mm/mm_stats.h>
+#include <mm/page.h>
 #include <sched/spinlock.h>
 #include <sched/kthread.h>
 
@@ -22,158 +28,226 @@
 // This subsystem accounts for a very large quantity of code in this kernel, thus we've
 // added SMALL
 
-typedef struct PACKED freemem_zero_width_struct {
-} freemem_zero_width_t;
+// Free regions are kept in a single tree ordered by address.  Every node also records
+// the longest region in its subtree, and the longest that is left once the start is
+// aligned to each power of two up to a page.  Allocation skips whole subtrees which
+// can't fit and finds the lowest region that fits in logarithmic time.
 
-TPL_BINTREE (region, size_t)
-TPL_BINTREE (p, freemem_zero_width_t)
-TPL_BINTREE (length, bintree_p_fields_t)
+// Alignment classes are 8 bytes up to PAGE_SIZE, smaller alignments use the 8 byte class.
+#define FREEMEM_ALIGN_MIN_SHIFT 3
+#define FREEMEM_ALIGN_CLASSES 10
+
+typedef struct freemem_node_data_struct {
+	size_t length;
+	// The longest length in the subtree rooted at this node.
+	size_t max_length;
+	// The longest length in the subtree once aligned to each class.
+	size_t max_aligned[FREEMEM_ALIGN_CLASSES];
+} freemem_node_data_t;
+
+TPL_BINTREE (region, freemem_node_data_t)
 
 TPL_SPARSE_COLLECTION(region_node, bintree_region_node_t)
-TPL_SPARSE_COLLECTION(p_node, bintree_p_node_t)
-TPL_SPARSE_COLLECTION(length_node, bintree_length_node_t)
+
+// Region nodes come from a pool of page sized chunks, each starting with its header so
+// the chunk of a node is found by rounding down.  The pool is topped up from freemem
+// itself between operations, and the reserve is enough for any single operation
+// (including the one taking the new chunk) to never run out part way through.
+
+#define FREEMEM_POOL_RESERVE 8
+
+typedef struct freemem_chunk_struct {
+	sparse_collection_region_node_t nodes;
+	size_t used;
+	size_t capacity;
+} freemem_chunk_t;
+
+TPL_LINKED_LIST(chunk, freemem_chunk_t)
 
 static bintree_region_t
 	region_tree_base,
 	*region_tree = &region_tree_base;
-static bintree_length_t
-	length_tree_base,
-	*length_tree = &length_tree_base;
-
-static sparse_collection_region_node_t
-	region_nodes_base,
-	*region_nodes = &region_nodes_base;
-static sparse_collection_p_node_t
-	p_nodes_base,
-	*p_nodes = &p_nodes_base;
-static sparse_collection_length_node_t
-	length_nodes_base,
-	*length_nodes = &length_nodes_base;
+
+// Chunks with unused nodes come before full ones, so a node is always found in the first.
+static linked_list_chunk_t
+	chunks_base,
+	*chunks = &chunks_base;
+// Unused nodes, across all chunks.
+static size_t chunks_free_count = 0;
+// Chunks with no nodes in use.
+static size_t chunks_empty_count = 0;
 
 static spinlock_t
 	freemem_lock_base,
 	*freemem_lock = &freemem_lock_base;
 
-// Panics if perfect matches cannot be found.
+#ifdef IZIX_MM_STATS
+// Only touched with the lock held.
+static mm_stats_sites_t freemem_stats_sites;
+static size_t freemem_suggest_steps;
+static size_t freemem_suggest_worst_steps = 0;
+
+#define FREEMEM_STATS_STEP() (freemem_suggest_steps += 1)
+#else
+#define FREEMEM_STATS_STEP()
+#endif
+
+static size_t freemem_get_max_length (bintree_region_node_t *region_node) {
+	return region_node ? region_node->data.max_length : 0;
+}
+
+static size_t freemem_get_max_aligned (bintree_region_node_t *region_node, size_t class) {
+	return region_node ? region_node->data.max_aligned[class] : 0;
+}
+
+// Length left in the region once its start is aligned to the class.
+static size_t freemem_get_aligned_length (
+		bintree_region_node_t *region_node,
+		size_t class
+) {
+	const size_t alignment = (size_t)1 << (FREEMEM_ALIGN_MIN_SHIFT + class);
+	const size_t p = region_node->orderby;
+	const size_t align_inc = p % alignment ? alignment - p % alignment : 0;
+
+	return region_node->data.length > align_inc ? region_node->data.length - align_inc : 0;
+}
+
+static void freemem_update (bintree_region_node_t *region_node) {
+	size_t max_length = region_node->data.length;
+	size_t class;
+
+	if (freemem_get_max_length (region_node->low) > max_length)
+		max_length = freemem_get_max_length (region_node->low);
+	if (freemem_get_max_length (region_node->high) > max_length)
+		max_length = freemem_get_max_length (region_node->high);
+
+	region_node->data.max_length = max_length;
+
+	for (class = 0; FREEMEM_ALIGN_CLASSES > class; ++class) {
+		size_t max_aligned = freemem_get_aligned_length (region_node, class);
+
+		if (freemem_get_max_aligned (region_node->low, class) > max_aligned)
+			max_aligned = freemem_get_max_aligned (region_node->low, class);
+		if (freemem_get_max_aligned (region_node->high, class) > max_aligned)
+			max_aligned = freemem_get_max_aligned (region_node->high, class);
+
+		region_node->data.max_aligned[class] = max_aligned;
+	}
+}
+
+static linked_list_chunk_node_t *freemem_get_chunk_node (const void *p) {
+	return (void *)((size_t)p - (size_t)p % PAGE_SIZE);
+}
+
 SMALL
-static bintree_region_node_t *freemem_get_nodes (
-		freemem_region_t region,
-		bintree_length_node_t **length_node_ptr,
-		bintree_p_node_t **p_node_ptr) {
-	bintree_region_node_t *region_node;
-	bintree_p_t p_tree_base, *p_tree = &p_tree_base;
+static void freemem_chunk_add (void *page) {
+	linked_list_chunk_node_t *chunk_node = page;
+	const size_t length = PAGE_SIZE - sizeof(linked_list_chunk_node_t);
 
-	region_node = region_tree->search (region_tree, (size_t)region.p);
-	*length_node_ptr = length_tree->search (length_tree, region.length);
+	*chunk_node = new_linked_list_chunk_node ((freemem_chunk_t){
+		.nodes = new_sparse_collection_region_node (
+			page + sizeof(linked_list_chunk_node_t),
+			length),
+		.used = 0
+	});
 
-	if (!region_node ||
-			(size_t)region.p != region_node->orderby ||
-			region.length != region_node->data) {
-		kputs ("mm/freemem: Failed to find matching region node!\n");
+	freemem_chunk_t *chunk = &chunk_node->data;
+	const size_t capacity = chunk->nodes.elm_arr_length;
+
+	chunk->capacity = capacity;
+
+	chunks->push (chunks, chunk_node);
+	chunks_free_count += capacity;
+	chunks_empty_count += 1;
+}
+
+SMALL
+static bintree_region_node_t *freemem_chunk_alloc () {
+	linked_list_chunk_node_t *chunk_node = chunks->start;
+	freemem_chunk_t *chunk = chunk_node ? &chunk_node->data : NULL;
+	const size_t i = chunk ? chunk->nodes.get (&chunk->nodes) : 0;
+
+	if (!i) {
+		kputs ("mm/freemem: failed to allocate new region node!\n");
 		kpanic ();
 	}
 
-	if (!*length_node_ptr ||
-			region.length != (*length_node_ptr)->orderby) {
-		kputs ("mm/freemem: Failed to find matching length node!\n");
-		kpanic ();
+	if (!chunk->used)
+		chunks_empty_count -= 1;
+	chunk->used += 1;
+	chunks_free_count -= 1;
+
+	// Full chunks go to the back.
+	if (chunk->capacity == chunk->used && chunk_node != chunks->end) {
+		chunks->removeNode (chunks, chunk_node);
+		chunks->append (chunks, chunk_node);
 	}
 
-	p_tree_base = new_bintree_p_from_fields ((*length_node_ptr)->data);
+	return chunk->nodes.alloc (&chunk->nodes, i);
+}
 
-	*p_node_ptr = p_tree->search (p_tree, (size_t)region.p);
+SMALL
+static void freemem_chunk_free (bintree_region_node_t *region_node) {
+	linked_list_chunk_node_t *chunk_node = freemem_get_chunk_node (region_node);
+	freemem_chunk_t *chunk = &chunk_node->data;
 
-	if (!*p_node_ptr ||
-			(size_t)region.p != (*p_node_ptr)->orderby) {
-		kputs ("mm/freemem: Failed to find matching p node!\n");
-		kpanic ();
+	chunk->nodes.free (&chunk->nodes, region_node);
+
+	// Chunks with unused nodes go to the front.
+	if (chunk->capacity == chunk->used && chunk_node != chunks->start) {
+		chunks->removeNode (chunks, chunk_node);
+		chunks->push (chunks, chunk_node);
 	}
 
-	return region_node;
+	chunk->used -= 1;
+	if (!chunk->used)
+		chunks_empty_count += 1;
+	chunks_free_count += 1;
 }
 
+// Panics if a perfect match cannot be found.
 SMALL
-static void freemem_delete (freemem_region_t region) {
+static bintree_region_node_t *freemem_get_node (freemem_region_t region) {
 	bintree_region_node_t *region_node;
-	bintree_length_node_t *length_node;
-	bintree_p_node_t *p_node;
-	bintree_p_t p_tree_base, *p_tree = &p_tree_base;
 
-	region_node = freemem_get_nodes (region, &length_node, &p_node);
+	region_node = region_tree->search (region_tree, (size_t)region.p);
+
+	if (!region_node ||
+			(size_t)region.p != region_node->orderby ||
+			region.length != region_node->data.length) {
+		kputs ("mm/freemem: Failed to find matching region node!\n");
+		kpanic ();
+	}
+
+	return region_node;
+}
 
-	p_tree_base = new_bintree_p_from_fields (length_node->data);
+SMALL
+static void freemem_delete (freemem_region_t region) {
+	bintree_region_node_t *region_node = freemem_get_node (region);
 
 	region_tree->remove (region_tree, region_node);
-	region_nodes->free (region_nodes, region_node);
-	p_tree->remove (p_tree, p_node);
-	p_nodes->free (p_nodes, p_node);
-	if (!p_tree->root) {
-		length_tree->remove (length_tree, length_node);
-		length_nodes->free (length_nodes, length_node);
-	} else {
-		length_node->data = p_tree->get_fields (p_tree);
-	}
+	freemem_chunk_free (region_node);
 }
 
 SMALL
 static void freemem_insert (freemem_region_t region) {
 	bintree_region_node_t *region_node, *region_conflict;
-	bintree_length_node_t *length_node, *length_conflict;
-	bintree_p_node_t *p_node, *p_conflict;
-	bintree_p_t p_tree_base, *p_tree = &p_tree_base;
-	size_t i;
 
-	i = region_nodes->get (region_nodes);
-	if (!i) {
-		kputs ("mm/freemem: failed to allocate new region node!\n");
-		kpanic ();
-	}
-	region_node = region_nodes->alloc (region_nodes, i);
+	region_node = freemem_chunk_alloc ();
 
-	i = p_nodes->get (p_nodes);
-	if (!i) {
-		kputs ("mm/freemem: failed to allocate new p node!\n");
-		kpanic ();
-	}
-	p_node = p_nodes->alloc (p_nodes, i);
-
-	*region_node = new_bintree_region_node (region.length, (size_t)region.p);
-	*p_node = new_bintree_p_node ((freemem_zero_width_t){}, (size_t)region.p);
-
-	// Find or allocate length node
-	length_node = length_tree->search (length_tree, region.length);
-	if (!length_node ||
-			region.length != length_node->orderby) {
-		i = length_nodes->get (length_nodes);
-		if (!i) {
-			kputs ("mm/freemem: failed to allocate new length node!\n");
-			kpanic ();
-		}
-		length_node = length_nodes->alloc (length_nodes, i);
+	freemem_node_data_t data = {
+		.length = region.length,
+		.max_length = region.length
+	};
 
-		*length_node = new_bintree_length_node (new_bintree_p_fields (), region.length);
-
-		length_conflict = length_tree->insert (length_tree, length_node);
-		if (length_conflict) {
-			kputs ("mm/freemem: failed to insert new length node!\n");
-			kputs ("\tbintree bug?\n");
-			kpanic ();
-		}
-	}
+	*region_node = new_bintree_region_node (data, (size_t)region.p);
 
 	region_conflict = region_tree->insert (region_tree, region_node);
 	if (region_conflict) {
 		kputs ("mm/freemem: failed to insert new region node!\n");
 		kpanic ();
 	}
-
-	p_tree_base = new_bintree_p_from_fields (length_node->data);
-	p_conflict = p_tree->insert (p_tree, p_node);
-	if (p_conflict) {
-		kputs ("mm/freemem: failed to insert new p node!\n");
-		kpanic ();
-	}
-	length_node->data = p_tree->get_fields (p_tree);
 }
 
 SMALL
@@ -260,7 +334,7 @@ static void freemem_defrag (freemem_region_t region) {
 		prev_region_node = iterator->cur (iterator);
 		prev_region = new_freemem_region (
 			(void *)prev_region_node->orderby,
-			prev_region_node->data);
+			prev_region_node->data.length);
 
 		new_region = freemem_maybe_join (region, prev_region);
 		if (new_region.length) {
@@ -278,74 +352,160 @@ static void freemem_defrag (freemem_region_t region) {
 		next_region_node = iterator->cur (iterator);
 		next_region = new_freemem_region (
 			(void *)next_region_node->orderby,
-			next_region_node->data);
+			next_region_node->data.length);
 
 		new_region = freemem_maybe_join (region, next_region);
 	}
 }
 
-static freemem_region_t freemem_suggest (
+// Padding needed to satisfy the alignment and offset for a region starting at p.
+SMALL
+static size_t freemem_get_align_inc (size_t p, size_t alignment, int offset) {
+	size_t align_inc;
+
+	if (p % alignment)
+		align_inc = alignment - p % alignment;
+	else
+		align_inc = 0;
+
+	if (0 <= offset) {
+		align_inc += offset;
+	} else {
+		if ((size_t)(-1 * offset) > align_inc)
+			align_inc += alignment;
+		align_inc -= -1 * offset;
+	}
+
+	return align_inc;
+}
+
+SMALL
+static bool freemem_node_fits (
+		bintree_region_node_t *region_node,
 		size_t length,
 		size_t alignment,
 		int offset
 ) {
-	bintree_p_t
-		p_length_tree_base,
-		*p_length_tree = &p_length_tree_base;
-	bintree_length_node_t *length_entry;
-	bintree_p_node_t *p_entry;
-	bintree_length_iterator_t
-		length_iterator_base,
-		*length_iterator = &length_iterator_base;
-	bintree_p_iterator_t
-		p_iterator_base,
-		*p_iterator = &p_iterator_base;
-
-	length_entry = length_tree->search (length_tree, length);
-	if (!length_entry)
-		return new_freemem_region (NULL, 0);
+	const size_t align_inc =
+		freemem_get_align_inc (region_node->orderby, alignment, offset);
+
+	return length + align_inc <= region_node->data.length;
+}
+
+// The alignment class for requests without an offset and aligned to a power of two up to
+// a page.  Returns false for anything else.
+SMALL
+static bool freemem_get_align_class (size_t alignment, int offset, size_t *class) {
+	if (offset || !alignment || alignment & (alignment - 1) || PAGE_SIZE < alignment)
+		return false;
+
+	// Aligning further than asked still satisfies the request.
+	if (((size_t)1 << FREEMEM_ALIGN_MIN_SHIFT) > alignment)
+		alignment = (size_t)1 << FREEMEM_ALIGN_MIN_SHIFT;
+
+	*class = __builtin_ctz (alignment) - FREEMEM_ALIGN_MIN_SHIFT;
+
+	return true;
+}
+
+// Lowest region which fits once aligned to the class, O(log n).
+static bintree_region_node_t *freemem_aligned_fit (size_t length, size_t class) {
+	bintree_region_node_t *region_node = region_tree->root;
+
+	if (length > freemem_get_max_aligned (region_node, class))
+		return NULL;
 
-	length_iterator_base = new_bintree_length_iterator (length_entry);
+	for (;;) {
+		FREEMEM_STATS_STEP ();
 
-	if (length > length_entry->orderby) {
-		length_entry = length_iterator->next (length_iterator);
-		if (!length_entry)
-			return new_freemem_region (NULL, 0);
+		if (length <= freemem_get_max_aligned (region_node->low, class))
+			region_node = region_node->low;
+		else if (length <= freemem_get_aligned_length (region_node, class))
+			return region_node;
+		else
+			region_node = region_node->high;
 	}
+}
+
+// Lowest region which fits once aligned, skipping subtrees which are too short even
+// without any padding.  Only used for requests without an alignment class when no region
+// is long enough to always fit, and then O(n) at worst.
+static bintree_region_node_t *freemem_first_fit (
+		bintree_region_node_t *region_node,
+		size_t length,
+		size_t alignment,
+		int offset
+) {
+	bintree_region_node_t *fit;
+
+	FREEMEM_STATS_STEP ();
 
-	do {
-		size_t align_inc;
+	if (length > freemem_get_max_length (region_node))
+		return NULL;
 
-		p_length_tree_base = new_bintree_p_from_fields (length_entry->data);
-		p_iterator_base = p_length_tree->new_iterator (p_length_tree);
+	fit = freemem_first_fit (region_node->low, length, alignment, offset);
+	if (fit)
+		return fit;
 
-		p_entry = p_iterator->cur (p_iterator);
-		while (p_entry) {
-			if ((size_t)p_entry->orderby % alignment)
-				align_inc = alignment - (size_t)p_entry->orderby % alignment;
-			else
-				align_inc = 0;
+	if (freemem_node_fits (region_node, length, alignment, offset))
+		return region_node;
 
-			if (0 <= offset) {
-				align_inc += offset;
+	return freemem_first_fit (region_node->high, length, alignment, offset);
+}
+
+static freemem_region_t freemem_suggest (
+		size_t length,
+		size_t alignment,
+		int offset
+) {
+	bintree_region_node_t *region_node = region_tree->root;
+	bintree_region_node_t *fit = NULL;
+	size_t class;
+
+	// Longest padding freemem_get_align_inc can return.
+	const size_t max_align_inc = alignment - 1 + (0 < offset ? offset : 0);
+
+#ifdef IZIX_MM_STATS
+	freemem_suggest_steps = 0;
+#endif
+
+	const bool has_class = freemem_get_align_class (alignment, offset, &class);
+
+	if (has_class) {
+		fit = freemem_aligned_fit (length, class);
+	} else if (length <= SIZE_MAX - max_align_inc) {
+		// Descend to the lowest region long enough to fit with any padding.  Shorter
+		// regions on the way down are taken instead if they happen to fit and are lower.
+		const size_t need = length + max_align_inc;
+
+		while (region_node && need <= region_node->data.max_length) {
+			FREEMEM_STATS_STEP ();
+
+			if (need <= freemem_get_max_length (region_node->low)) {
+				region_node = region_node->low;
+			} else if (freemem_node_fits (region_node, length, alignment, offset)) {
+				fit = region_node;
+				break;
 			} else {
-				if ((size_t)(-1 * offset) > align_inc)
-					align_inc += alignment;
-				align_inc -= -1 * offset;
+				region_node = region_node->high;
 			}
+		}
+	}
 
-			if (length + align_inc <= length_entry->orderby)
-				return new_freemem_region (
-					(void *)p_entry->orderby + align_inc,
-					length);
+	if (!fit && !has_class)
+		fit = freemem_first_fit (region_tree->root, length, alignment, offset);
 
-			p_entry = p_iterator->next (p_iterator);
-		}
+#ifdef IZIX_MM_STATS
+	if (freemem_suggest_steps > freemem_suggest_worst_steps)
+		freemem_suggest_worst_steps = freemem_suggest_steps;
+#endif
+
+	if (!fit)
+		return new_freemem_region (NULL, 0);
 
-		length_entry = length_iterator->next (length_iterator);
-	} while (length_entry);
+	const size_t align_inc = freemem_get_align_inc (fit->orderby, alignment, offset);
 
-	return new_freemem_region (NULL, 0);
+	return new_freemem_region ((void *)fit->orderby + align_inc, length);
 }
 
 static bool freemem_add_region_internal (freemem_region_t region) {
@@ -369,14 +529,14 @@ static bool freemem_remove_region_internal (freemem_region_t region) {
 	if ((size_t)region.p < parent->orderby)
 		parent = iterator->prev (iterator);
 	else {
-		parent_region = new_freemem_region ((void *)parent->orderby, parent->data);
+		parent_region = new_freemem_region ((void *)parent->orderby, parent->data.length);
 
 		if (freemem_region_end (region) > freemem_region_end (parent_region))
 			parent = iterator->next (iterator);
 	}
 	if (!parent)
 		return false;
-	parent_region = new_freemem_region ((void *)parent->orderby, parent->data);
+	parent_region = new_freemem_region ((void *)parent->orderby, parent->data.length);
 
 	if (!freemem_is_subset (parent_region, region))
 		return false;
@@ -421,6 +581,81 @@ static bool freemem_remove_region_internal (freemem_region_t region) {
 	return true;
 }
 
+// Free regions directly before and after an allocated region, or zeroed if there are none.
+SMALL
+static void freemem_get_neighbours (
+		freemem_region_t region,
+		freemem_region_t *before,
+		freemem_region_t *after
+) {
+	bintree_region_iterator_t iterator_base, *iterator = &iterator_base;
+	bintree_region_node_t *region_node, *prev_region_node, *next_region_node;
+
+	*before = *after = new_freemem_region (NULL, 0);
+
+	region_node = region_tree->search (region_tree, (size_t)region.p);
+	if (!region_node)
+		return;
+
+	iterator_base = new_bintree_region_iterator (region_node);
+	if ((size_t)region.p > region_node->orderby) {
+		prev_region_node = region_node;
+		next_region_node = iterator->next (iterator);
+	} else {
+		next_region_node = region_node;
+		prev_region_node = iterator->prev (iterator);
+	}
+
+	if (prev_region_node &&
+			(void *)prev_region_node->orderby + prev_region_node->data.length == region.p)
+		*before = new_freemem_region (
+			(void *)prev_region_node->orderby, prev_region_node->data.length);
+
+	if (next_region_node && (void *)next_region_node->orderby == freemem_region_end (region))
+		*after = new_freemem_region (
+			(void *)next_region_node->orderby, next_region_node->data.length);
+}
+
+// Grow the allocated region to length from the free regions around it.  Space after it
+// is used first, so the start only moves down when that isn't enough.
+static freemem_region_t freemem_extend_internal (
+		freemem_region_t region,
+		size_t length,
+		size_t alignment
+) {
+	freemem_region_t before, after;
+
+	freemem_get_neighbours (region, &before, &after);
+
+	if (region.length + after.length >= length) {
+		freemem_remove_region_internal (new_freemem_region (
+			freemem_region_end (region), length - region.length));
+
+		return new_freemem_region (region.p, length);
+	}
+
+	if (!before.length || region.length + after.length + before.length < length)
+		return new_freemem_region (NULL, 0);
+
+	void *new_p = freemem_region_end (after.length ? after : region) - length;
+	new_p -= (size_t)new_p % alignment;
+
+	if (new_p < before.p)
+		return new_freemem_region (NULL, 0);
+
+	// Aligning down can leave the region's own end past the new one, keep the tail
+	// rather than losing it.
+	if (new_p + length < freemem_region_end (region))
+		length = freemem_region_end (region) - new_p;
+
+	freemem_remove_region_internal (new_freemem_region (new_p, region.p - new_p));
+	if (new_p + length > freemem_region_end (region))
+		freemem_remove_region_internal (new_freemem_region (
+			freemem_region_end (region), new_p + length - freemem_region_end (region)));
+
+	return new_freemem_region (new_p, length);
+}
+
 static freemem_region_t freemem_alloc_internal (
 		size_t length,
 		size_t alignment,
@@ -437,49 +672,149 @@ static freemem_region_t freemem_alloc_internal (
 	return suggestion;
 }
 
-// Must be called before initializing kthreads
+// Grow the pool back up to the reserve, and give back empty chunks once there is more
+// than a chunk to spare.  Only called between operations, never part way through one.
+SMALL
+static void freemem_chunks_balance () {
+	while (FREEMEM_POOL_RESERVE > chunks_free_count) {
+		const freemem_region_t region = freemem_alloc_internal (PAGE_SIZE, PAGE_SIZE, 0);
+		if (!region.length)
+			return;
+
+		freemem_chunk_add (region.p);
+	}
+
+	linked_list_chunk_iterator_t iterator_base, *iterator = &iterator_base;
+	linked_list_chunk_node_t *chunk_node;
+
+	iterator_base = chunks->new_iterator (chunks);
+	chunk_node = iterator->cur (iterator);
+
+	while (chunks_empty_count && chunk_node) {
+		freemem_chunk_t *chunk = &chunk_node->data;
+		linked_list_chunk_node_t *next_chunk_node = iterator->next (iterator);
+
+		// Keep twice the reserve around, so one region coming and going doesn't bounce
+		// a chunk in and out of the pool.
+		if (2 * FREEMEM_POOL_RESERVE + chunk->capacity > chunks_free_count)
+			return;
+		// Only full chunks follow.
+		if (chunk->capacity == chunk->used)
+			return;
+
+		if (!chunk->used) {
+			chunks->removeNode (chunks, chunk_node);
+			chunks_free_count -= chunk->capacity;
+			chunks_empty_count -= 1;
+
+			freemem_add_region_internal (new_freemem_region (chunk_node, PAGE_SIZE));
+		}
+
+		chunk_node = next_chunk_node;
+	}
+}
+
+// Must be called before initializing kthreads.  Only the whole pages of the internal
+// region are used, the pool grows from freemem once there are regions in it.
 COLD
 void freemem_init (void *internal, size_t internal_length) {
 	freemem_lock_base = new_spinlock ();
 
 	region_tree_base = new_bintree_region ();
-	length_tree_base = new_bintree_length ();
-
-	size_t total_size =
-		4 * sizeof(bintree_region_node_t) +
-		sizeof(bintree_length_node_t) +
-		4 * sizeof(bintree_p_node_t);
+	region_tree_base.update = freemem_update;
 
-	void *next_data = internal;
-	size_t next_size = 0;
+	chunks_base = new_linked_list_chunk ();
 
-	next_data += next_size;
-	next_size = internal_length * 4 * sizeof(bintree_region_node_t) / total_size;
-	region_nodes_base = new_sparse_collection_region_node (next_data, next_size);
+	void *page = internal;
+	if ((size_t)page % PAGE_SIZE)
+		page += PAGE_SIZE - (size_t)page % PAGE_SIZE;
 
-	next_data += next_size;
-	next_size = internal_length * sizeof(bintree_length_node_t) / total_size;
-	length_nodes_base = new_sparse_collection_length_node (next_data, next_size);
-
-	next_data += next_size;
-	next_size = internal_length * 4 * sizeof(bintree_p_node_t) / total_size;
-	p_nodes_base = new_sparse_collection_p_node (next_data, next_size);
+	for (; internal + internal_length >= page + PAGE_SIZE; page += PAGE_SIZE)
+		freemem_chunk_add (page);
 }
 
 bool freemem_add_region (freemem_region_t region) {
 	spinlock_lock (freemem_lock);
 
 	const bool ret = freemem_add_region_internal (region);
+	freemem_chunks_balance ();
+
+#ifdef IZIX_MM_STATS
+	mm_stats_record_free (&freemem_stats_sites, MM_STATS_CALLER (), region.length);
+#endif
 
 	spinlock_release (freemem_lock);
 
 	return ret;
 }
 
+// Balanced subtree of the sorted regions, built bottom up from the middle outwards.
+COLD
+static bintree_region_node_t *freemem_build_subtree (
+		const freemem_region_t *regions,
+		size_t count,
+		bintree_region_node_t *parent
+) {
+	if (!count)
+		return NULL;
+
+	const size_t middle = count / 2;
+	bintree_region_node_t *region_node = freemem_chunk_alloc ();
+
+	freemem_node_data_t data = {
+		.length = regions[middle].length,
+		.max_length = regions[middle].length
+	};
+
+	*region_node = new_bintree_region_node (data, (size_t)regions[middle].p);
+	region_node->parent = parent;
+
+	region_node->low = freemem_build_subtree (regions, middle, region_node);
+	region_node->high = freemem_build_subtree (
+		regions + middle + 1, count - middle - 1, region_node);
+
+	const size_t low_height = region_node->low ? region_node->low->height : 0;
+	const size_t high_height = region_node->high ? region_node->high->height : 0;
+
+	region_node->height = 1 + (low_height > high_height ? low_height : high_height);
+	freemem_update (region_node);
+
+	return region_node;
+}
+
+// Halves never differ in size by more than one, so the tree is already balanced.
+COLD
+void freemem_build (const freemem_region_t *regions, size_t count) {
+	spinlock_lock (freemem_lock);
+
+	if (region_tree->root) {
+		kputs ("mm/freemem: Regions can only be built into an empty tree!\n");
+		kpanic ();
+	}
+
+	region_tree->root = freemem_build_subtree (regions, count, NULL);
+	freemem_chunks_balance ();
+
+#ifdef IZIX_MM_STATS
+	size_t i;
+	for (i = 0; count > i; ++i)
+		mm_stats_record_free (
+			&freemem_stats_sites, MM_STATS_CALLER (), regions[i].length);
+#endif
+
+	spinlock_release (freemem_lock);
+}
+
 bool freemem_remove_region (freemem_region_t region) {
 	spinlock_lock (freemem_lock);
 
 	const bool ret = freemem_remove_region_internal (region);
+	freemem_chunks_balance ();
+
+#ifdef IZIX_MM_STATS
+	if (ret)
+		mm_stats_record_alloc (&freemem_stats_sites, MM_STATS_CALLER (), region.length);
+#endif
 
 	spinlock_release (freemem_lock);
 
@@ -490,10 +825,106 @@ freemem_region_t freemem_alloc (size_t length, size_t alignment, int offset) {
 	spinlock_lock (freemem_lock);
 
 	const freemem_region_t ret = freemem_alloc_internal (length, alignment, offset);
+	freemem_chunks_balance ();
+
+#ifdef IZIX_MM_STATS
+	if (ret.length)
+		mm_stats_record_alloc (&freemem_stats_sites, MM_STATS_CALLER (), ret.length);
+#endif
+
+	spinlock_release (freemem_lock);
+
+	return ret;
+}
+
+freemem_region_t freemem_extend (freemem_region_t region, size_t length, size_t alignment) {
+	if (region.length >= length)
+		return region;
+
+	spinlock_lock (freemem_lock);
+
+	const freemem_region_t ret = freemem_extend_internal (region, length, alignment);
+	freemem_chunks_balance ();
+
+#ifdef IZIX_MM_STATS
+	if (ret.length)
+		mm_stats_record_alloc (
+			&freemem_stats_sites, MM_STATS_CALLER (), ret.length - region.length);
+#endif
 
 	spinlock_release (freemem_lock);
 
 	return ret;
 }
 
+freemem_region_t freemem_alloc_zeroed (size_t length, size_t alignment, int offset) {
+	const freemem_region_t ret = freemem_alloc (length, alignment, offset);
+
+	if (ret.length)
+		memset (ret.p, 0, ret.length);
+
+	return ret;
+}
+
+#ifdef IZIX_MM_STATS
+void freemem_get_stats (freemem_stats_t *stats) {
+	bintree_region_iterator_t iterator_base, *iterator = &iterator_base;
+	bintree_region_node_t *region_node;
+	linked_list_chunk_iterator_t chunk_iterator_base, *chunk_iterator = &chunk_iterator_base;
+	linked_list_chunk_node_t *chunk_node;
+	size_t i;
+
+	stats->regions = 0;
+	stats->free_bytes = 0;
+	stats->chunks = 0;
+	stats->nodes_used = 0;
+	for (i = 0; MM_STATS_BUCKETS > i; ++i)
+		stats->histogram[i] = 0;
+
+	spinlock_lock (freemem_lock);
+
+	region_node = region_tree->min (region_tree);
+	iterator_base = new_bintree_region_iterator (region_node);
+
+	for (; region_node; region_node = iterator->next (iterator)) {
+		stats->regions += 1;
+		stats->free_bytes += region_node->data.length;
+		stats->histogram[mm_stats_get_bucket (region_node->data.length)] += 1;
+	}
+
+	chunk_iterator_base = chunks->new_iterator (chunks);
+
+	for (chunk_node = chunk_iterator->cur (chunk_iterator); chunk_node;
+			chunk_node = chunk_iterator->next (chunk_iterator)) {
+		stats->chunks += 1;
+		stats->nodes_used += chunk_node->data.used;
+	}
+
+	stats->largest = freemem_get_max_length (region_tree->root);
+	stats->nodes_free = chunks_free_count;
+	stats->suggest_worst_steps = freemem_suggest_worst_steps;
+	stats->sites = freemem_stats_sites;
+
+	spinlock_release (freemem_lock);
+}
+
+void freemem_dump_stats () {
+	freemem_stats_t stats;
+
+	freemem_get_stats (&stats);
+
+	kprintf (
+		"mm/freemem: %zu regions, %zu bytes free, largest %zu\n",
+		stats.regions, stats.free_bytes, stats.largest);
+	kprintf (
+		"mm/freemem: %zu node chunks, %zu nodes used, %zu free\n",
+		stats.chunks, stats.nodes_used, stats.nodes_free);
+	kprintf (
+		"mm/freemem: At most %zu nodes visited per allocation\n",
+		stats.suggest_worst_steps);
+	mm_stats_dump_histogram ("mm/freemem", stats.histogram);
+	mm_stats_dump_sites ("mm/freemem", &stats.sites);
+}
+#endif
+
 // vim: set ts=4 sw=4 noet syn=c:
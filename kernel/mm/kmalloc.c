@@ -0,0 +1,203 @@
+// kernel/mm/kmalloc.c
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <attributes.h>
+#include <string.h>
+
+#include <asm/toggle_int.h>
+#include <kprint/kprint.h>
+#include <kpanic/kpanic.h>
+#include <mm/kmalloc.h>
+#include <mm/malloc.h>
+#include <sched/kthread.h>
+
+// The reserve has a stack of objects from malloc for each power-of-two size class.  The
+// stacks, and the list of frees waiting for the kthread, are only touched with
+// interrupts disabled, and nothing else may touch them from an interrupt handler.
+
+#define KMALLOC_CLASSES 6
+#define KMALLOC_RESERVE 8
+// Below this many objects left the kthread is woken to refill.
+#define KMALLOC_WATERMARK 4
+
+typedef struct kmalloc_reserve_struct {
+	void *objects[KMALLOC_RESERVE];
+	size_t count;
+} kmalloc_reserve_t;
+
+// Kept in the memory being freed, every allocation fits a pointer.
+typedef struct kmalloc_deferred_struct {
+	struct kmalloc_deferred_struct *next;
+} kmalloc_deferred_t;
+
+static kmalloc_reserve_t kmalloc_reserves[KMALLOC_CLASSES];
+static kmalloc_deferred_t *kmalloc_deferred = NULL;
+
+static volatile kpid_t kmalloc_refill_kpid = -1;
+// Set when the kthread could not be woken, the next normal call wakes it instead.
+static volatile bool kmalloc_refill_pending = false;
+
+static bool kmalloc_disable_int () {
+	const bool int_enabled = int_is_enabled ();
+
+	disable_int ();
+
+	return int_enabled;
+}
+
+static void kmalloc_restore_int (bool int_enabled) {
+	if (int_enabled)
+		enable_int ();
+}
+
+static size_t kmalloc_get_class_size (size_t class) {
+	return (size_t)KMALLOC_ATOMIC_MIN_SIZE << class;
+}
+
+static size_t kmalloc_get_class (size_t size) {
+	size_t class = 0;
+
+	while (kmalloc_get_class_size (class) < size)
+		class += 1;
+
+	return class;
+}
+
+// The kthread lists may only be changed if whatever was interrupted wasn't changing them.
+static void kmalloc_wake_refill () {
+	if (0 > kmalloc_refill_kpid)
+		return;
+
+	if (kthread_lock_task ())
+		kthread_wake (kmalloc_refill_kpid);
+	else
+		kmalloc_refill_pending = true;
+	kthread_unlock_task ();
+}
+
+static void *kmalloc_atomic (size_t size) {
+	void *ptr = NULL;
+
+	if (!size || KMALLOC_ATOMIC_MAX_SIZE < size)
+		return NULL;
+
+	kmalloc_reserve_t *reserve = &kmalloc_reserves[kmalloc_get_class (size)];
+
+	const bool int_enabled = kmalloc_disable_int ();
+
+	if (reserve->count) {
+		reserve->count -= 1;
+		ptr = reserve->objects[reserve->count];
+	}
+
+	const bool low = KMALLOC_WATERMARK > reserve->count;
+
+	kmalloc_restore_int (int_enabled);
+
+	// Tried every time the reserve is low, in case an earlier wake was missed.
+	if (low)
+		kmalloc_wake_refill ();
+
+	return ptr;
+}
+
+// Only called from normal context.
+static void kmalloc_refill () {
+	size_t class;
+
+	for (class = 0; KMALLOC_CLASSES > class; ++class) {
+		kmalloc_reserve_t *reserve = &kmalloc_reserves[class];
+
+		// Only this adds to the reserve, so it can't fill up while malloc is called.
+		while (KMALLOC_RESERVE > reserve->count) {
+			void *ptr = malloc (kmalloc_get_class_size (class));
+			if (!ptr)
+				return;
+
+			const bool int_enabled = kmalloc_disable_int ();
+			reserve->objects[reserve->count] = ptr;
+			reserve->count += 1;
+			kmalloc_restore_int (int_enabled);
+		}
+	}
+}
+
+static void kmalloc_free_deferred () {
+	const bool int_enabled = kmalloc_disable_int ();
+	kmalloc_deferred_t *deferred = kmalloc_deferred;
+	kmalloc_deferred = NULL;
+	kmalloc_restore_int (int_enabled);
+
+	while (deferred) {
+		kmalloc_deferred_t *next = deferred->next;
+
+		free (deferred);
+		deferred = next;
+	}
+}
+
+static void kmalloc_background_task_refill () {
+	kputs ("mm/kmalloc: Started reserve refill background task.\n");
+
+	for (;;) {
+		kmalloc_refill_pending = false;
+
+		kmalloc_free_deferred ();
+		kmalloc_refill ();
+
+		kthread_block ();
+	}
+}
+
+void kmalloc_init () {
+	kmalloc_refill ();
+
+	// Refilling takes the allocators' locks, so it runs among the threads which hold them
+	// rather than above or below them all.
+	kmalloc_refill_kpid = kthread_new_blocking_task (
+		kmalloc_background_task_refill, KTHREAD_PRIORITY_DEFAULT);
+	if (0 > kmalloc_refill_kpid) {
+		kputs ("mm/kmalloc: Failed to create reserve refill background task!\n");
+		kpanic ();
+	}
+}
+
+void *kmalloc (size_t size, kmalloc_flags_t flags) {
+	void *ptr;
+
+	if (flags & KMALLOC_ATOMIC) {
+		ptr = kmalloc_atomic (size);
+		if (ptr && flags & KMALLOC_ZERO)
+			memset (ptr, 0, size);
+
+		return ptr;
+	}
+
+	if (kmalloc_refill_pending)
+		kmalloc_wake_refill ();
+
+	return flags & KMALLOC_ZERO ? calloc (1, size) : malloc (size);
+}
+
+void kfree (void *ptr, kmalloc_flags_t flags) {
+	if (!ptr)
+		return;
+
+	if (!(flags & KMALLOC_ATOMIC)) {
+		free (ptr);
+		return;
+	}
+
+	kmalloc_deferred_t *deferred = ptr;
+
+	const bool int_enabled = kmalloc_disable_int ();
+	deferred->next = kmalloc_deferred;
+	kmalloc_deferred = deferred;
+	kmalloc_restore_int (int_enabled);
+
+	kmalloc_wake_refill ();
+}
+
+// vim: set ts=4 sw=4 noet syn=c:
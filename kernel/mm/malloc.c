@@ -1,13 +1,41 @@
 // kernel/mm/malloc.c
 
 #include <stddef.h>
+#include <stdbool.h>
 
 #include <string.h>
 
+#include <attributes.h>
+
 #include <kpanic/kpanic.h>
 #include <kprint/kprint.h>
+#include <mm/buddy.h>
 #include <mm/freemem.h>
 #include <mm/malloc.h>
+#include <mm/mm_stats.h>
+#include <mm/page.h>
+#include <mm/slab.h>
+#include <mm/vmalloc.h>
+#include <sched/spinlock.h>
+
+// The heap grows from the buddy allocator at least this much at a time.
+#define MALLOC_GROW_MIN_ORDER 4
+// Allocations at least this large are mapped page by page when vmalloc is available,
+// rather than needing a physically contiguous region.
+#define MALLOC_VMALLOC_MIN_SIZE (16 * (size_t)PAGE_SIZE)
+
+#ifdef IZIX_MM_STATS
+static malloc_stats_t malloc_stats;
+
+static spinlock_t
+	malloc_stats_lock_base,
+	*malloc_stats_lock = &malloc_stats_lock_base;
+
+CONSTRUCTOR
+static void malloc_stats_construct () {
+	malloc_stats_lock_base = new_spinlock ();
+}
+#endif
 
 static inline void *malloc_get_internal_ptr (void *ptr) {
 	return ptr - MALLOC_ALIGNMENT;
@@ -39,14 +67,65 @@ static inline size_t malloc_get_shared_size (size_t size) {
 	return size - MALLOC_ALIGNMENT;
 }
 
-void *malloc (size_t size) {
+// Regions without a header are only rounded up to the basic alignment.
+static inline size_t malloc_get_sized_size (size_t size) {
+	const size_t alignment = alignof(__malloc_max_align_t);
+
+	if (size % alignment)
+		size += alignment - size % alignment;
+
+	return size;
+}
+
+// Move a block from the buddy allocator into freemem, large enough for internal_size.
+// Heap blocks are never given back, they are merged into the rest of freemem.
+static bool malloc_grow (size_t internal_size) {
+	size_t order = buddy_get_order (internal_size);
+	if (MALLOC_GROW_MIN_ORDER > order)
+		order = MALLOC_GROW_MIN_ORDER;
+
+	void *block = buddy_alloc (order);
+	if (!block)
+		return false;
+
+	const bool add_success =
+		freemem_add_region (new_freemem_region (block, (size_t)PAGE_SIZE << order));
+	if (!add_success) {
+		kputs ("mm/malloc: Failed to add buddy block to freemem!\n");
+		kpanic ();
+	}
+
+	return true;
+}
+
+static void *malloc_internal (size_t size, bool zeroed) {
+	freemem_region_t (*const alloc) (size_t, size_t, int) =
+		zeroed ? freemem_alloc_zeroed : freemem_alloc;
+
 	if (!size)
 		return NULL;
 
+	// Small objects come from the slab allocator without a header, the large ones (or
+	// small ones if there are no slabs left) get a header and their own region.
+	if (SLAB_MAX_SIZE >= size) {
+		void *ptr = slab_alloc (size);
+		if (ptr)
+			return zeroed ? memset (ptr, 0, size) : ptr;
+	}
+
+	if (MALLOC_VMALLOC_MIN_SIZE <= size) {
+		void *ptr = zeroed ? vzalloc (size) : vmalloc (size);
+		if (ptr)
+			return ptr;
+	}
+
 	size_t internal_size = malloc_get_internal_size (size);
 
 	// Avoid fragmentation and add room for size_t
-	freemem_region_t region = freemem_alloc (internal_size, MALLOC_ALIGNMENT, 0);
+	freemem_region_t region = alloc (internal_size, MALLOC_ALIGNMENT, 0);
+
+	if (!region.length && malloc_grow (internal_size))
+		region = alloc (internal_size, MALLOC_ALIGNMENT, 0);
 
 	if (!region.length)
 		return NULL;  // ENOMEM
@@ -60,10 +139,158 @@ void *malloc (size_t size) {
 	return ptr;
 }
 
+#ifdef IZIX_MM_STATS
+static void malloc_stats_record_alloc (void *ptr, size_t size, const void *site) {
+	if (!ptr)
+		return;
+
+	spinlock_lock (malloc_stats_lock);
+
+	mm_stats_record_alloc (&malloc_stats.sites, site, size);
+
+	if (!slab_owns (ptr) && !vmalloc_owns (ptr)) {
+		const size_t allocated_size =
+			malloc_get_allocated_size (malloc_get_internal_ptr (ptr));
+
+		malloc_stats.regions += 1;
+		malloc_stats.region_bytes += allocated_size;
+		malloc_stats.padding_bytes += allocated_size - MALLOC_ALIGNMENT - size;
+	}
+
+	spinlock_release (malloc_stats_lock);
+}
+
+// Must be called before the pointer is freed.
+static void malloc_stats_record_free (void *ptr, const void *site) {
+	size_t size;
+
+	if (!ptr)
+		return;
+
+	if (slab_owns (ptr)) {
+		size = slab_get_size (ptr);
+	} else if (vmalloc_owns (ptr)) {
+		size = vmalloc_get_size (ptr);
+	} else {
+		size = malloc_get_allocated_size (malloc_get_internal_ptr (ptr));
+
+		spinlock_lock (malloc_stats_lock);
+		malloc_stats.regions -= 1;
+		malloc_stats.region_bytes -= size;
+		spinlock_release (malloc_stats_lock);
+	}
+
+	spinlock_lock (malloc_stats_lock);
+	mm_stats_record_free (&malloc_stats.sites, site, size);
+	spinlock_release (malloc_stats_lock);
+}
+
+// A region resized in place by realloc.
+static void malloc_stats_record_resize (size_t allocated_size, size_t internal_size) {
+	spinlock_lock (malloc_stats_lock);
+	malloc_stats.region_bytes += internal_size - allocated_size;
+	spinlock_release (malloc_stats_lock);
+}
+#endif
+
+void *malloc (size_t size) {
+	void *ptr = malloc_internal (size, false);
+
+#ifdef IZIX_MM_STATS
+	malloc_stats_record_alloc (ptr, size, MM_STATS_CALLER ());
+#endif
+
+	return ptr;
+}
+
+void *calloc (size_t nmemb, size_t size) {
+	if (size && (size_t)-1 / size < nmemb)
+		return NULL;  // ENOMEM
+
+	void *ptr = malloc_internal (nmemb * size, true);
+
+#ifdef IZIX_MM_STATS
+	malloc_stats_record_alloc (ptr, nmemb * size, MM_STATS_CALLER ());
+#endif
+
+	return ptr;
+}
+
+static void *malloc_aligned_internal (size_t alignment, size_t size) {
+	if (!size || !alignment || alignment & (alignment - 1))
+		return NULL;
+
+	// Slab objects are aligned to their size class.
+	if (SLAB_MAX_SIZE >= size && SLAB_MAX_SIZE >= alignment) {
+		void *ptr = slab_alloc (size > alignment ? size : alignment);
+		if (ptr)
+			return ptr;
+	}
+
+	if (MALLOC_VMALLOC_MIN_SIZE <= size && PAGE_SIZE >= alignment) {
+		void *ptr = vmalloc (size);
+		if (ptr)
+			return ptr;
+	}
+
+	const size_t sized_size = malloc_get_sized_size (size);
+
+	freemem_region_t region = freemem_alloc (sized_size, alignment, 0);
+
+	if (!region.length && malloc_grow (sized_size + alignment))
+		region = freemem_alloc (sized_size, alignment, 0);
+
+	if (!region.length)
+		return NULL;  // ENOMEM
+
+	return region.p;
+}
+
+void *aligned_alloc (size_t alignment, size_t size) {
+	void *ptr = malloc_aligned_internal (alignment, size);
+
+#ifdef IZIX_MM_STATS
+	if (ptr) {
+		spinlock_lock (malloc_stats_lock);
+		mm_stats_record_alloc (&malloc_stats.sites, MM_STATS_CALLER (), size);
+		spinlock_release (malloc_stats_lock);
+	}
+#endif
+
+	return ptr;
+}
+
+static void *realloc_slab (void *ptr, size_t size) {
+	const size_t slab_size = slab_get_size (ptr);
+
+	if (size <= slab_size)
+		return ptr;
+
+	void *new_ptr = malloc (size);
+
+	if (!new_ptr)
+		return NULL;
+
+	memcpy (new_ptr, ptr, slab_size);
+
+	slab_free (ptr);
+
+	return new_ptr;
+}
+
 void *realloc (void *ptr, size_t size) {
+	if (!ptr)
+		return malloc (size);
+
 	if (!size)
 		return NULL;
 
+	if (slab_owns (ptr))
+		return realloc_slab (ptr, size);
+
+	if (vmalloc_owns (ptr))
+		return vrealloc (ptr, size);
+
 	void *internal_ptr = malloc_get_internal_ptr (ptr);
 	size_t internal_size = malloc_get_internal_size (size);
 
@@ -76,7 +303,7 @@ void *realloc (void *ptr, size_t size) {
 		size_t extra_size = allocated_size - internal_size;
 
 		freemem_region_t extra_region = new_freemem_region (
-				internal_ptr + extra_size, extra_size);
+				internal_ptr + internal_size, extra_size);
 
 		bool readd_success = freemem_add_region (extra_region);
 		if (!readd_success) {
@@ -88,20 +315,30 @@ void *realloc (void *ptr, size_t size) {
 
 		malloc_set_allocated_size (internal_ptr, internal_size);
 
+#ifdef IZIX_MM_STATS
+		malloc_stats_record_resize (allocated_size, internal_size);
+#endif
+
 		return ptr;
 	}
 
-	size_t additional_size = internal_size - allocated_size;
-	freemem_region_t next_region = new_freemem_region (
-			internal_ptr + allocated_size, additional_size);
+	// Grow into the free space on either side, the contents only move if the start does.
+	freemem_region_t region = freemem_extend (
+		new_freemem_region (internal_ptr, allocated_size), internal_size, MALLOC_ALIGNMENT);
 
-	// Attempt to remove.
-	bool remove_success = freemem_remove_region (next_region);
+	if (region.length) {
+		void *new_ptr = malloc_get_shared_ptr (region.p);
 
-	if (remove_success) {
-		malloc_set_allocated_size (internal_ptr, internal_size);
+		if (new_ptr != ptr)
+			memmove (new_ptr, ptr, malloc_get_shared_size (allocated_size));
 
-		return ptr;
+		malloc_set_allocated_size (region.p, region.length);
+
+#ifdef IZIX_MM_STATS
+		malloc_stats_record_resize (allocated_size, region.length);
+#endif
+
+		return new_ptr;
 	}
 
 	// Try a new region.
@@ -114,15 +351,24 @@ void *realloc (void *ptr, size_t size) {
 
 	free (ptr);
 
-	ptr = new_ptr;
-	internal_ptr = malloc_get_internal_ptr (ptr);
-
-	malloc_set_allocated_size (internal_ptr, internal_size);
-
-	return ptr;
+	return new_ptr;
 }
 
 void free (void *ptr) {
+#ifdef IZIX_MM_STATS
+	malloc_stats_record_free (ptr, MM_STATS_CALLER ());
+#endif
+
+	if (slab_owns (ptr)) {
+		slab_free (ptr);
+		return;
+	}
+
+	if (vmalloc_owns (ptr)) {
+		vfree (ptr);
+		return;
+	}
+
 	void *internal_ptr = malloc_get_internal_ptr (ptr);
 
 	size_t size = malloc_get_allocated_size (internal_ptr);
@@ -136,4 +382,56 @@ void free (void *ptr) {
 	}
 }
 
+void free_sized (void *ptr, size_t size) {
+	if (!ptr)
+		return;
+
+#ifdef IZIX_MM_STATS
+	spinlock_lock (malloc_stats_lock);
+	mm_stats_record_free (&malloc_stats.sites, MM_STATS_CALLER (), size);
+	spinlock_release (malloc_stats_lock);
+#endif
+
+	if (slab_owns (ptr)) {
+		slab_free (ptr);
+		return;
+	}
+
+	if (vmalloc_owns (ptr)) {
+		vfree (ptr);
+		return;
+	}
+
+	freemem_region_t region = new_freemem_region (ptr, malloc_get_sized_size (size));
+
+	bool add_success = freemem_add_region (region);
+	if (!add_success) {
+		kputs ("mm/malloc: Failed to free supposedly allocated sized region!\n");
+		kpanic ();
+	}
+}
+
+#ifdef IZIX_MM_STATS
+void malloc_get_stats (malloc_stats_t *stats) {
+	spinlock_lock (malloc_stats_lock);
+
+	*stats = malloc_stats;
+	stats->header_bytes = stats->regions * MALLOC_ALIGNMENT;
+
+	spinlock_release (malloc_stats_lock);
+}
+
+void malloc_dump_stats () {
+	malloc_stats_t stats;
+
+	malloc_get_stats (&stats);
+
+	kprintf (
+		"mm/malloc: %zu regions, %zu bytes of which %zu are headers\n",
+		stats.regions, stats.region_bytes, stats.header_bytes);
+	kprintf ("mm/malloc: %zu bytes padding allocated\n", stats.padding_bytes);
+	mm_stats_dump_sites ("mm/malloc", &stats.sites);
+}
+#endif
+
 // vim: set ts=4 sw=4 noet syn=c:
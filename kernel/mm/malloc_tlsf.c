@@ -0,0 +1,147 @@
+// kernel/mm/malloc_tlsf.c
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <string.h>
+
+#include <asm/toggle_int.h>
+#include <mm/buddy.h>
+#include <mm/malloc.h>
+#include <mm/page.h>
+#include <mm/slab.h>
+#include <mm/tlsf.h>
+#include <mm/vmalloc.h>
+
+// malloc backed by the TLSF heap rather than slabs and freemem, selected with
+// MALLOC=tlsf.  Anything that would not go to vmalloc may be allocated and freed with
+// interrupts disabled, including from interrupt handlers.
+
+// The heap grows from the buddy allocator at least this much at a time.
+#define MALLOC_GROW_MIN_ORDER 4
+// As in malloc.c, but only when the caller could wait for vmalloc's lock.
+#define MALLOC_VMALLOC_MIN_SIZE (16 * (size_t)PAGE_SIZE)
+
+// Growing with interrupts disabled never waits for the buddy allocator's lock, so it
+// fails if the code interrupted holds it.
+static bool malloc_grow (size_t size) {
+	size_t order = buddy_get_order (tlsf_get_pool_size (size));
+	if (MALLOC_GROW_MIN_ORDER > order)
+		order = MALLOC_GROW_MIN_ORDER;
+
+	void *block = int_is_enabled () ? buddy_alloc (order) : buddy_try_alloc (order);
+	if (!block)
+		return false;
+
+	if (!tlsf_add_pool (block, (size_t)PAGE_SIZE << order)) {
+		buddy_free (block, order);
+		return false;
+	}
+
+	return true;
+}
+
+static void *malloc_internal (size_t size, bool zeroed) {
+	void *ptr;
+
+	if (!size)
+		return NULL;
+
+	if (MALLOC_VMALLOC_MIN_SIZE <= size && int_is_enabled ()) {
+		ptr = zeroed ? vzalloc (size) : vmalloc (size);
+		if (ptr)
+			return ptr;
+	}
+
+	ptr = tlsf_alloc (size);
+	if (!ptr && malloc_grow (size))
+		ptr = tlsf_alloc (size);
+
+	if (ptr && zeroed)
+		memset (ptr, 0, size);
+
+	return ptr;
+}
+
+void *malloc (size_t size) {
+	return malloc_internal (size, false);
+}
+
+void *calloc (size_t nmemb, size_t size) {
+	if (size && (size_t)-1 / size < nmemb)
+		return NULL;  // ENOMEM
+
+	return malloc_internal (nmemb * size, true);
+}
+
+// TLSF blocks are only TLSF_ALIGNMENT aligned, anything more comes from the slab
+// allocator or vmalloc, neither of which may be used with interrupts disabled.
+void *aligned_alloc (size_t alignment, size_t size) {
+	if (!size || !alignment || alignment & (alignment - 1))
+		return NULL;
+
+	if (TLSF_ALIGNMENT >= alignment)
+		return malloc_internal (size, false);
+
+	// Slab objects are aligned to their size class.
+	if (SLAB_MAX_SIZE >= size && SLAB_MAX_SIZE >= alignment)
+		return slab_alloc (size > alignment ? size : alignment);
+
+	if (PAGE_SIZE >= alignment)
+		return vmalloc (size);
+
+	return NULL;
+}
+
+void *realloc (void *ptr, size_t size) {
+	if (!ptr)
+		return malloc_internal (size, false);
+
+	if (!size)
+		return NULL;
+
+	if (vmalloc_owns (ptr))
+		return vrealloc (ptr, size);
+
+	const size_t old_size = tlsf_get_size (ptr);
+
+	if (size <= old_size)
+		return ptr;
+
+	void *new_ptr = malloc_internal (size, false);
+
+	if (!new_ptr)
+		return NULL;
+
+	memcpy (new_ptr, ptr, old_size);
+
+	tlsf_free (ptr);
+
+	return new_ptr;
+}
+
+void free (void *ptr) {
+	if (!ptr)
+		return;
+
+	if (vmalloc_owns (ptr)) {
+		vfree (ptr);
+		return;
+	}
+
+	tlsf_free (ptr);
+}
+
+void free_sized (void *ptr, size_t size) {
+	// Blocks know their own size.
+	(void)size;
+
+	if (ptr && slab_owns (ptr)) {
+		slab_free (ptr);
+		return;
+	}
+
+	free (ptr);
+}
+
+// vim: set ts=4 sw=4 noet syn=c:
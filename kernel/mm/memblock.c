@@ -0,0 +1,196 @@
+// kernel/mm/memblock.c
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <attributes.h>
+
+#include <kprint/kprint.h>
+#include <kpanic/kpanic.h>
+#include <mm/buddy.h>
+#include <mm/freemem.h>
+#include <mm/memblock.h>
+
+// Conventional memory is broken up by the firmware and whatever boot reserved, which
+// freemem copes with better, so only memory above it is handed to the buddy allocator.
+#define MEMBLOCK_HIGH_MEMORY ((void *)0x100000)
+
+// Usable ranges which are neither reserved nor allocated, ordered by their start.
+static freemem_region_t memblock_regions[MEMBLOCK_MAX_REGIONS];
+static size_t memblock_region_count;
+
+COLD
+static void memblock_insert (size_t index, freemem_region_t region) {
+	size_t i;
+
+	if (MEMBLOCK_MAX_REGIONS == memblock_region_count) {
+		kputs ("mm/memblock: Too many regions!\n");
+		kpanic ();
+	}
+
+	for (i = memblock_region_count; index < i; --i)
+		memblock_regions[i] = memblock_regions[i - 1];
+
+	memblock_regions[index] = region;
+	++memblock_region_count;
+}
+
+COLD
+static void memblock_remove (size_t index) {
+	size_t i;
+
+	--memblock_region_count;
+
+	for (i = index; memblock_region_count > i; ++i)
+		memblock_regions[i] = memblock_regions[i + 1];
+}
+
+// The regions must overlap or touch, and low must not start after high.
+COLD
+static freemem_region_t memblock_join (freemem_region_t low, freemem_region_t high) {
+	void *const end = freemem_region_end (high) > freemem_region_end (low) ?
+		freemem_region_end (high) : freemem_region_end (low);
+
+	return new_freemem_region (low.p, end - low.p);
+}
+
+COLD
+void memblock_add (freemem_region_t region) {
+	size_t i;
+
+	if (!region.length)
+		return;
+
+	for (i = 0; memblock_region_count > i; ++i)
+		if (memblock_regions[i].p > region.p)
+			break;
+
+	// Firmware maps are neither sorted nor disjoint, so merge with any neighbours this
+	// overlaps or touches.
+	if (i && freemem_region_end (memblock_regions[i - 1]) >= region.p) {
+		region = memblock_join (memblock_regions[--i], region);
+		memblock_remove (i);
+	}
+
+	while (memblock_region_count > i &&
+			freemem_region_end (region) >= memblock_regions[i].p) {
+		region = memblock_join (region, memblock_regions[i]);
+		memblock_remove (i);
+	}
+
+	memblock_insert (i, region);
+}
+
+COLD
+void memblock_reserve (freemem_region_t region) {
+	void *const end = freemem_region_end (region);
+	size_t i = 0;
+
+	while (memblock_region_count > i) {
+		const freemem_region_t cur = memblock_regions[i];
+		void *const cur_end = freemem_region_end (cur);
+
+		if (cur_end <= region.p || cur.p >= end) {
+			++i;
+			continue;
+		}
+
+		const freemem_region_t
+			head = new_freemem_region (cur.p, cur.p < region.p ? region.p - cur.p : 0),
+			tail = new_freemem_region (end, cur_end > end ? cur_end - end : 0);
+
+		if (!head.length && !tail.length) {
+			memblock_remove (i);
+			continue;
+		}
+
+		if (head.length) {
+			memblock_regions[i++] = head;
+			if (tail.length)
+				memblock_insert (i++, tail);
+		} else {
+			memblock_regions[i++] = tail;
+		}
+	}
+}
+
+COLD
+void *memblock_alloc (size_t length, size_t alignment) {
+	size_t i;
+
+	for (i = 0; memblock_region_count > i; ++i) {
+		const freemem_region_t cur = memblock_regions[i];
+		void *const cur_end = freemem_region_end (cur);
+		void *p = cur.p;
+
+		if ((size_t)p % alignment)
+			p += alignment - (size_t)p % alignment;
+
+		// NULL would look like a failure.
+		if (!p)
+			p += alignment;
+
+		if (p < cur.p || p > cur_end || (size_t)(cur_end - p) < length)
+			continue;
+
+		memblock_reserve (new_freemem_region (p, length));
+
+		return p;
+	}
+
+	return NULL;
+}
+
+// Appends to the regions for freemem, joining it to the last one if they touch.
+COLD
+static void memblock_release_low (
+		freemem_region_t *regions,
+		size_t *count,
+		freemem_region_t region
+) {
+	if (*count && freemem_region_end (regions[*count - 1]) == region.p)
+		regions[*count - 1].length += region.length;
+	else
+		regions[(*count)++] = region;
+}
+
+COLD
+void memblock_release () {
+	// Only the region straddling high memory can be split in two.
+	freemem_region_t regions[MEMBLOCK_MAX_REGIONS + 1];
+	size_t count = 0;
+	size_t i;
+
+	for (i = 0; memblock_region_count > i; ++i) {
+		freemem_region_t region = memblock_regions[i];
+
+		if (MEMBLOCK_HIGH_MEMORY < freemem_region_end (region)) {
+			freemem_region_t high_region = region;
+
+			if (MEMBLOCK_HIGH_MEMORY > region.p) {
+				high_region = new_freemem_region (
+					MEMBLOCK_HIGH_MEMORY,
+					freemem_region_end (region) - MEMBLOCK_HIGH_MEMORY);
+				region.length -= high_region.length;
+			} else {
+				region.length = 0;
+			}
+
+			if (region.length)
+				memblock_release_low (regions, &count, region);
+
+			// Whatever the buddy allocator won't take still goes to freemem.
+			if (!buddy_add_region (high_region))
+				memblock_release_low (regions, &count, high_region);
+		} else {
+			memblock_release_low (regions, &count, region);
+		}
+	}
+
+	memblock_region_count = 0;
+
+	// The regions are sorted and disjoint, so freemem can build its tree in one go.
+	freemem_build (regions, count);
+}
+
+// vim: set ts=4 sw=4 noet syn=c:
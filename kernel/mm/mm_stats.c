@@ -0,0 +1,80 @@
+// kernel/mm/mm_stats.c
+
+#include <stddef.h>
+
+#include <kprint/kprint.h>
+#include <mm/mm_stats.h>
+
+static mm_stats_site_t *mm_stats_get_site (mm_stats_sites_t *sites, const void *site) {
+	size_t i;
+
+	for (i = 0; sites->count > i; ++i) {
+		if (site == sites->sites[i].site)
+			return &sites->sites[i];
+	}
+
+	if (MM_STATS_SITES == sites->count)
+		return &sites->sites[MM_STATS_SITES - 1];
+
+	mm_stats_site_t *stats_site = &sites->sites[sites->count];
+	sites->count += 1;
+
+	// Everything else shares the last slot.
+	*stats_site = (mm_stats_site_t){
+		.site = MM_STATS_SITES == sites->count ? NULL : site,
+		.allocs = 0,
+		.alloc_bytes = 0,
+		.frees = 0,
+		.free_bytes = 0
+	};
+
+	return stats_site;
+}
+
+void mm_stats_record_alloc (mm_stats_sites_t *sites, const void *site, size_t bytes) {
+	mm_stats_site_t *stats_site = mm_stats_get_site (sites, site);
+
+	stats_site->allocs += 1;
+	stats_site->alloc_bytes += bytes;
+}
+
+void mm_stats_record_free (mm_stats_sites_t *sites, const void *site, size_t bytes) {
+	mm_stats_site_t *stats_site = mm_stats_get_site (sites, site);
+
+	stats_site->frees += 1;
+	stats_site->free_bytes += bytes;
+}
+
+size_t mm_stats_get_bucket (size_t length) {
+	size_t bucket = 0;
+
+	while (length >>= 1)
+		bucket += 1;
+
+	return bucket;
+}
+
+void mm_stats_dump_sites (const char *name, const mm_stats_sites_t *sites) {
+	size_t i;
+
+	for (i = 0; sites->count > i; ++i) {
+		const mm_stats_site_t *site = &sites->sites[i];
+
+		kprintf (
+			"%s: %p: %zu allocs (%zu bytes), %zu frees (%zu bytes)\n",
+			name, site->site,
+			site->allocs, site->alloc_bytes,
+			site->frees, site->free_bytes);
+	}
+}
+
+void mm_stats_dump_histogram (const char *name, const size_t *histogram) {
+	size_t i;
+
+	for (i = 0; MM_STATS_BUCKETS > i; ++i) {
+		if (histogram[i])
+			kprintf ("%s: >= %zu bytes: %zu\n", name, (size_t)1 << i, histogram[i]);
+	}
+}
+
+// vim: set ts=4 sw=4 noet syn=c:
@@ -0,0 +1,61 @@
+// kernel/mm/shrinker.c
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <attributes.h>
+
+#include <kprint/kprint.h>
+#include <kpanic/kpanic.h>
+#include <mm/shrinker.h>
+#include <sched/spinlock.h>
+
+static const shrinker_t *shrinkers[SHRINKER_MAX];
+static size_t shrinker_total = 0;
+
+// Held while reclaiming, so an allocation made by a shrinker can't reclaim again.
+static spinlock_t
+	shrinker_lock_base,
+	*shrinker_lock = &shrinker_lock_base;
+
+CONSTRUCTOR
+static void shrinker_construct () {
+	shrinker_lock_base = new_spinlock ();
+}
+
+void shrinker_register (const shrinker_t *shrinker) {
+	if (SHRINKER_MAX == shrinker_total) {
+		kputs ("mm/shrinker: Too many shrinkers registered!\n");
+		kpanic ();
+	}
+
+	shrinkers[shrinker_total] = shrinker;
+	shrinker_total += 1;
+}
+
+size_t shrinker_count () {
+	size_t i, count = 0;
+
+	for (i = 0; shrinker_total > i; ++i)
+		count += shrinkers[i]->count ();
+
+	return count;
+}
+
+size_t shrinker_reclaim (size_t length) {
+	size_t i, reclaimed = 0;
+
+	if (!spinlock_try_lock (shrinker_lock))
+		return 0;
+
+	for (i = 0; shrinker_total > i && length > reclaimed; ++i) {
+		if (shrinkers[i]->count ())
+			reclaimed += shrinkers[i]->reclaim (length - reclaimed);
+	}
+
+	spinlock_release (shrinker_lock);
+
+	return reclaimed;
+}
+
+// vim: set ts=4 sw=4 noet syn=c:
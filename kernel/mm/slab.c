@@ -0,0 +1,446 @@
+// kernel/mm/slab.c
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <attributes.h>
+#include <collections/linked_list.h>
+
+#include <kprint/kprint.h>
+#include <kpanic/kpanic.h>
+#include <mm/buddy.h>
+#include <mm/page.h>
+#include <mm/shrinker.h>
+#include <mm/slab.h>
+#include <sched/spinlock.h>
+
+// Every slab is a single page carved out of a naturally aligned arena.  The first page
+// of each arena holds the descriptors of the others, so objects carry no header at all:
+// the arena is found by masking the pointer and the descriptor by its page index.
+
+#define SLAB_ARENA_ORDER 5
+#define SLAB_ARENA_PAGES (1 << SLAB_ARENA_ORDER)
+#define SLAB_ARENA_SIZE  (SLAB_ARENA_PAGES * PAGE_SIZE)
+
+#define SLAB_ARENA_MAP_BITS   (8 * sizeof(unsigned int))
+#define SLAB_ARENA_MAP_LENGTH \
+	(((size_t)UINTPTR_MAX / SLAB_ARENA_SIZE + 1) / SLAB_ARENA_MAP_BITS)
+
+#define SLAB_CLASS_MIN_SHIFT 4
+#define SLAB_CLASS_COUNT     8
+
+typedef struct slab_object_struct slab_object_t;
+typedef struct slab_object_struct {
+	slab_object_t *next;
+} slab_object_t;
+
+typedef struct slab_cache_struct slab_cache_t;
+
+typedef struct slab_struct {
+	slab_cache_t *cache;
+	// Objects which have been freed back to this slab.
+	slab_object_t *free_objects;
+	// Objects past this point have never been handed out.
+	void *unused;
+	size_t inuse;
+} slab_t;
+
+TPL_LINKED_LIST(slab, slab_t)
+
+typedef struct slab_cache_struct {
+	const char *name;
+	kmem_cache_ctor_t ctor;
+	// Size of the object rounded up to the alignment.
+	size_t size;
+	// Objects per slab.
+	size_t count;
+	// Slabs with at least one free and one allocated object.
+	linked_list_slab_t partial;
+} slab_cache_t;
+
+typedef struct slab_arena_struct {
+	size_t free_count;
+	linked_list_slab_t free_slabs;
+	// Index zero describes the page these descriptors live in, and is never used.
+	linked_list_slab_node_t slabs[SLAB_ARENA_PAGES];
+} slab_arena_t;
+
+TPL_LINKED_LIST(slab_arena, slab_arena_t)
+
+static slab_cache_t slab_caches[SLAB_CLASS_COUNT];
+
+static slab_cache_t kmem_caches[KMEM_CACHE_MAX];
+static size_t kmem_cache_count = 0;
+
+// Arenas with at least one unused page.
+static linked_list_slab_arena_t
+	slab_arenas_base,
+	*slab_arenas = &slab_arenas_base;
+static size_t slab_arena_count = 0;
+
+// One bit for every possible arena in the address space.
+static unsigned int slab_arena_map[SLAB_ARENA_MAP_LENGTH];
+
+static spinlock_t
+	slab_lock_base,
+	*slab_lock = &slab_lock_base;
+
+static size_t slab_get_class (size_t size) {
+	if ((1 << SLAB_CLASS_MIN_SHIFT) >= size)
+		return 0;
+
+	// Ceiling of log2 (size), from the position of the highest set bit.
+	const size_t shift = 8 * sizeof(unsigned int) - __builtin_clz (size - 1);
+
+	return shift - SLAB_CLASS_MIN_SHIFT;
+}
+
+static size_t slab_arena_map_index (const void *ptr) {
+	return (size_t)ptr / SLAB_ARENA_SIZE;
+}
+
+static void slab_arena_map_set (const void *ptr) {
+	const size_t i = slab_arena_map_index (ptr);
+
+	slab_arena_map[i / SLAB_ARENA_MAP_BITS] |= 1U << (i % SLAB_ARENA_MAP_BITS);
+}
+
+static void slab_arena_map_unset (const void *ptr) {
+	const size_t i = slab_arena_map_index (ptr);
+
+	slab_arena_map[i / SLAB_ARENA_MAP_BITS] &= ~(1U << (i % SLAB_ARENA_MAP_BITS));
+}
+
+static bool slab_arena_map_test (const void *ptr) {
+	const size_t i = slab_arena_map_index (ptr);
+
+	return slab_arena_map[i / SLAB_ARENA_MAP_BITS] & (1U << (i % SLAB_ARENA_MAP_BITS));
+}
+
+static linked_list_slab_arena_node_t *slab_get_arena_node (const void *ptr) {
+	return (void *)((size_t)ptr - (size_t)ptr % SLAB_ARENA_SIZE);
+}
+
+static linked_list_slab_node_t *slab_get_slab_node (const void *ptr) {
+	linked_list_slab_arena_node_t *arena_node = slab_get_arena_node (ptr);
+	const size_t i = ((size_t)ptr % SLAB_ARENA_SIZE) / PAGE_SIZE;
+
+	return &arena_node->data.slabs[i];
+}
+
+static page_t *slab_get_page (linked_list_slab_node_t *slab_node) {
+	linked_list_slab_arena_node_t *arena_node = slab_get_arena_node (slab_node);
+	const size_t i = slab_node - arena_node->data.slabs;
+
+	return (page_t *)arena_node + i;
+}
+
+static linked_list_slab_arena_node_t *slab_arena_new () {
+	// Buddy blocks are naturally aligned, just as arenas need to be.
+	linked_list_slab_arena_node_t *arena_node = buddy_alloc (SLAB_ARENA_ORDER);
+	if (!arena_node)
+		return NULL;
+
+	slab_arena_t *arena = &arena_node->data;
+	size_t i;
+
+	*arena_node = new_linked_list_slab_arena_node ((slab_arena_t){
+		.free_count = SLAB_ARENA_PAGES - 1,
+		.free_slabs = new_linked_list_slab ()
+	});
+
+	for (i = 1; SLAB_ARENA_PAGES > i; ++i) {
+		arena->slabs[i] = new_linked_list_slab_node ((slab_t){});
+		arena->free_slabs.append (&arena->free_slabs, &arena->slabs[i]);
+	}
+
+	slab_arena_map_set (arena_node);
+	slab_arena_count += 1;
+
+	slab_arenas->append (slab_arenas, arena_node);
+
+	return arena_node;
+}
+
+static void slab_arena_delete (linked_list_slab_arena_node_t *arena_node) {
+	slab_arenas->removeNode (slab_arenas, arena_node);
+
+	slab_arena_map_unset (arena_node);
+	slab_arena_count -= 1;
+
+	buddy_free (arena_node, SLAB_ARENA_ORDER);
+}
+
+static linked_list_slab_node_t *slab_new (slab_cache_t *cache) {
+	linked_list_slab_arena_node_t *arena_node = slab_arenas->peek (slab_arenas);
+	if (!arena_node) {
+		arena_node = slab_arena_new ();
+		if (!arena_node)
+			return NULL;
+	}
+
+	slab_arena_t *arena = &arena_node->data;
+
+	linked_list_slab_node_t *slab_node = arena->free_slabs.pop (&arena->free_slabs);
+
+	arena->free_count -= 1;
+	if (!arena->free_count)
+		slab_arenas->removeNode (slab_arenas, arena_node);
+
+	slab_node->data = (slab_t){
+		.cache = cache,
+		.free_objects = NULL,
+		.unused = slab_get_page (slab_node),
+		.inuse = 0
+	};
+
+	return slab_node;
+}
+
+static void slab_delete (linked_list_slab_node_t *slab_node) {
+	linked_list_slab_arena_node_t *arena_node = slab_get_arena_node (slab_node);
+	slab_arena_t *arena = &arena_node->data;
+
+	arena->free_slabs.append (&arena->free_slabs, slab_node);
+
+	if (!arena->free_count)
+		slab_arenas->append (slab_arenas, arena_node);
+	arena->free_count += 1;
+
+	// Keep the last arena around, so a single object being allocated and freed over and
+	// over doesn't bounce an arena in and out of the buddy allocator.
+	if (SLAB_ARENA_PAGES - 1 == arena->free_count && 1 < slab_arena_count)
+		slab_arena_delete (arena_node);
+}
+
+static void *slab_take_object (slab_t *slab) {
+	void *object;
+
+	if (slab->free_objects) {
+		object = slab->free_objects;
+		slab->free_objects = slab->free_objects->next;
+	} else {
+		object = slab->unused;
+		slab->unused += slab->cache->size;
+	}
+
+	slab->inuse += 1;
+
+	return object;
+}
+
+static void slab_give_object (slab_t *slab, void *object) {
+	slab_object_t *free_object = object;
+
+	free_object->next = slab->free_objects;
+	slab->free_objects = free_object;
+
+	slab->inuse -= 1;
+}
+
+static slab_cache_t new_slab_cache (
+		const char *name,
+		size_t size,
+		size_t align,
+		kmem_cache_ctor_t ctor
+) {
+	// Free objects hold the free list link.
+	if (sizeof(slab_object_t) > size)
+		size = sizeof(slab_object_t);
+
+	if (size % align)
+		size += align - size % align;
+
+	slab_cache_t cache = {
+		.name = name,
+		.ctor = ctor,
+		.size = size,
+		.count = PAGE_SIZE / size,
+		.partial = new_linked_list_slab ()
+	};
+
+	return cache;
+}
+
+static void *slab_cache_alloc (slab_cache_t *cache) {
+	spinlock_lock (slab_lock);
+
+	linked_list_slab_node_t *slab_node = cache->partial.peek (&cache->partial);
+	if (!slab_node) {
+		slab_node = slab_new (cache);
+		if (!slab_node) {
+			spinlock_release (slab_lock);
+			return NULL;  // ENOMEM
+		}
+
+		cache->partial.append (&cache->partial, slab_node);
+	}
+
+	void *object = slab_take_object (&slab_node->data);
+
+	if (cache->count == slab_node->data.inuse)
+		cache->partial.removeNode (&cache->partial, slab_node);
+
+	spinlock_release (slab_lock);
+
+	return object;
+}
+
+static void slab_cache_free (slab_cache_t *cache, void *ptr) {
+	linked_list_slab_node_t *slab_node = slab_get_slab_node (ptr);
+
+	spinlock_lock (slab_lock);
+
+	// Full slabs aren't in any list.
+	if (cache->count == slab_node->data.inuse)
+		cache->partial.append (&cache->partial, slab_node);
+
+	slab_give_object (&slab_node->data, ptr);
+
+	if (!slab_node->data.inuse) {
+		cache->partial.removeNode (&cache->partial, slab_node);
+		slab_delete (slab_node);
+	}
+
+	spinlock_release (slab_lock);
+}
+
+static bool slab_arena_is_empty (linked_list_slab_arena_node_t *arena_node) {
+	return SLAB_ARENA_PAGES - 1 == arena_node->data.free_count;
+}
+
+// Only the last empty arena is ever kept, but count them all anyway.
+static size_t slab_count_empty () {
+	linked_list_slab_arena_iterator_t iterator_base, *iterator = &iterator_base;
+	linked_list_slab_arena_node_t *arena_node;
+	size_t count = 0;
+
+	if (!spinlock_try_lock (slab_lock))
+		return 0;
+
+	iterator_base = slab_arenas->new_iterator (slab_arenas);
+
+	for (arena_node = iterator->cur (iterator); arena_node;
+			arena_node = iterator->next (iterator)) {
+		if (slab_arena_is_empty (arena_node))
+			count += SLAB_ARENA_SIZE;
+	}
+
+	spinlock_release (slab_lock);
+
+	return count;
+}
+
+static size_t slab_reclaim (size_t length) {
+	linked_list_slab_arena_iterator_t iterator_base, *iterator = &iterator_base;
+	linked_list_slab_arena_node_t *arena_node;
+	size_t reclaimed = 0;
+
+	if (!spinlock_try_lock (slab_lock))
+		return 0;
+
+	iterator_base = slab_arenas->new_iterator (slab_arenas);
+	arena_node = iterator->cur (iterator);
+
+	while (arena_node && length > reclaimed) {
+		linked_list_slab_arena_node_t *next_arena_node = iterator->next (iterator);
+
+		if (slab_arena_is_empty (arena_node)) {
+			slab_arena_delete (arena_node);
+			reclaimed += SLAB_ARENA_SIZE;
+		}
+
+		arena_node = next_arena_node;
+	}
+
+	spinlock_release (slab_lock);
+
+	return reclaimed;
+}
+
+static const shrinker_t slab_shrinker = {
+	.name = "slab",
+	.count = slab_count_empty,
+	.reclaim = slab_reclaim
+};
+
+CONSTRUCTOR
+static void slab_construct () {
+	size_t i;
+
+	slab_lock_base = new_spinlock ();
+	slab_arenas_base = new_linked_list_slab_arena ();
+
+	for (i = 0; SLAB_CLASS_COUNT > i; ++i) {
+		const size_t size = 1 << (SLAB_CLASS_MIN_SHIFT + i);
+
+		slab_caches[i] = new_slab_cache ("size", size, size, NULL);
+	}
+
+	shrinker_register (&slab_shrinker);
+}
+
+void *slab_alloc (size_t size) {
+	if (!size || SLAB_MAX_SIZE < size)
+		return NULL;
+
+	return slab_cache_alloc (&slab_caches[slab_get_class (size)]);
+}
+
+void slab_free (void *ptr) {
+	slab_cache_free (slab_get_slab_node (ptr)->data.cache, ptr);
+}
+
+bool slab_owns (const void *ptr) {
+	return slab_arena_map_test (ptr);
+}
+
+size_t slab_get_size (const void *ptr) {
+	return slab_get_slab_node (ptr)->data.cache->size;
+}
+
+kmem_cache_t *kmem_cache_create (
+		const char *name,
+		size_t size,
+		size_t align,
+		kmem_cache_ctor_t ctor
+) {
+	if (!align || align & (align - 1) || PAGE_SIZE < size || PAGE_SIZE < align)
+		return NULL;
+
+	spinlock_lock (slab_lock);
+
+	if (KMEM_CACHE_MAX == kmem_cache_count) {
+		spinlock_release (slab_lock);
+		return NULL;
+	}
+
+	kmem_cache_t *cache = &kmem_caches[kmem_cache_count++];
+
+	spinlock_release (slab_lock);
+
+	*cache = new_slab_cache (name, size, align, ctor);
+
+	return cache;
+}
+
+void *kmem_cache_alloc (kmem_cache_t *cache) {
+	void *object = slab_cache_alloc (cache);
+
+	if (object && cache->ctor)
+		cache->ctor (object);
+
+	return object;
+}
+
+void kmem_cache_free (kmem_cache_t *cache, void *ptr) {
+	if (cache != slab_get_slab_node (ptr)->data.cache) {
+		kprintf ("mm/slab: Object %p freed to the wrong cache %s!\n", ptr, cache->name);
+		kpanic ();
+	}
+
+	slab_cache_free (cache, ptr);
+}
+
+// vim: set ts=4 sw=4 noet syn=c:
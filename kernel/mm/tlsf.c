@@ -0,0 +1,315 @@
+// kernel/mm/tlsf.c
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <attributes.h>
+
+#include <asm/toggle_int.h>
+#include <kprint/kprint.h>
+#include <kpanic/kpanic.h>
+#include <mm/tlsf.h>
+#include <sched/spinlock.h>
+
+// Every block starts with a header holding its size and a pointer to the block physically
+// before it, which is only kept up to date while that block is free.  Free blocks keep
+// their list links at the start of their payload.  Each pool ends with an empty block in
+// use, so the block after any other block always exists.
+//
+// The first level class of a size is its highest set bit, the second level splits each
+// class into TLSF_SL_COUNT evenly sized lists.  Sizes below TLSF_SMALL_SIZE all share the
+// first class, split evenly by TLSF_ALIGNMENT.
+
+#define TLSF_ALIGNMENT_LOG2 3
+#define TLSF_SL_COUNT_LOG2  4
+#define TLSF_SL_COUNT       (1 << TLSF_SL_COUNT_LOG2)
+#define TLSF_FL_SHIFT       (TLSF_SL_COUNT_LOG2 + TLSF_ALIGNMENT_LOG2)
+#define TLSF_SMALL_SIZE     (1 << TLSF_FL_SHIFT)
+// The class of TLSF_MAX_SIZE after rounding up is the last one.
+#define TLSF_FL_COUNT       (22 - TLSF_FL_SHIFT + 2)
+
+// Low bits of the size, which is always a multiple of TLSF_ALIGNMENT.
+#define TLSF_BLOCK_FREE      0b01
+#define TLSF_BLOCK_PREV_FREE 0b10
+#define TLSF_BLOCK_FLAGS     0b11
+
+typedef struct tlsf_block_struct {
+	struct tlsf_block_struct *prev_phys;
+	size_t size;
+	// Only while free, these are the start of the payload.
+	struct tlsf_block_struct *next_free;
+	struct tlsf_block_struct *prev_free;
+} tlsf_block_t;
+
+#define TLSF_BLOCK_OVERHEAD offsetof(tlsf_block_t, next_free)
+// A free block must fit its links.
+#define TLSF_BLOCK_MIN_SIZE (sizeof(tlsf_block_t) - TLSF_BLOCK_OVERHEAD)
+// The first block's header and the closing empty block.
+#define TLSF_POOL_OVERHEAD  (2 * TLSF_BLOCK_OVERHEAD)
+
+static uint32_t tlsf_fl_bitmap = 0;
+static uint32_t tlsf_sl_bitmap[TLSF_FL_COUNT];
+static tlsf_block_t *tlsf_blocks[TLSF_FL_COUNT][TLSF_SL_COUNT];
+
+static spinlock_t
+	tlsf_lock_base,
+	*tlsf_lock = &tlsf_lock_base;
+
+CONSTRUCTOR
+static void tlsf_construct () {
+	tlsf_lock_base = new_spinlock ();
+}
+
+// Never yields.  It is only held with interrupts disabled, so it is never held by
+// anything this could have interrupted.
+static bool tlsf_lock_heap () {
+	const bool int_enabled = int_is_enabled ();
+
+	disable_int ();
+	while (!spinlock_try_lock (tlsf_lock));
+
+	return int_enabled;
+}
+
+static void tlsf_unlock_heap (bool int_enabled) {
+	spinlock_release (tlsf_lock);
+
+	if (int_enabled)
+		enable_int ();
+}
+
+static size_t tlsf_fls (size_t n) {
+	return 8 * sizeof(unsigned int) - 1 - __builtin_clz (n);
+}
+
+static size_t tlsf_block_size (const tlsf_block_t *block) {
+	return block->size & ~(size_t)TLSF_BLOCK_FLAGS;
+}
+
+static void *tlsf_block_payload (tlsf_block_t *block) {
+	return (void *)block + TLSF_BLOCK_OVERHEAD;
+}
+
+static tlsf_block_t *tlsf_payload_block (const void *ptr) {
+	return (tlsf_block_t *)(ptr - TLSF_BLOCK_OVERHEAD);
+}
+
+static tlsf_block_t *tlsf_block_next (tlsf_block_t *block) {
+	return tlsf_block_payload (block) + tlsf_block_size (block);
+}
+
+static tlsf_block_t *tlsf_block_link_next (tlsf_block_t *block) {
+	tlsf_block_t *next = tlsf_block_next (block);
+
+	next->prev_phys = block;
+
+	return next;
+}
+
+static void tlsf_block_mark_free (tlsf_block_t *block) {
+	tlsf_block_link_next (block)->size |= TLSF_BLOCK_PREV_FREE;
+	block->size |= TLSF_BLOCK_FREE;
+}
+
+static void tlsf_block_mark_used (tlsf_block_t *block) {
+	tlsf_block_next (block)->size &= ~(size_t)TLSF_BLOCK_PREV_FREE;
+	block->size &= ~(size_t)TLSF_BLOCK_FREE;
+}
+
+static void tlsf_mapping_insert (size_t size, size_t *fl, size_t *sl) {
+	if (TLSF_SMALL_SIZE > size) {
+		*fl = 0;
+		*sl = size >> TLSF_ALIGNMENT_LOG2;
+	} else {
+		const size_t bit = tlsf_fls (size);
+
+		*fl = bit - (TLSF_FL_SHIFT - 1);
+		*sl = (size >> (bit - TLSF_SL_COUNT_LOG2)) ^ TLSF_SL_COUNT;
+	}
+}
+
+// Round up to the next list, so every block in the list found is large enough.
+static size_t tlsf_mapping_round (size_t size) {
+	if (TLSF_SMALL_SIZE > size)
+		return size;
+
+	const size_t round = ((size_t)1 << (tlsf_fls (size) - TLSF_SL_COUNT_LOG2)) - 1;
+
+	return (size + round) & ~round;
+}
+
+static size_t tlsf_adjust_size (size_t size) {
+	if (TLSF_BLOCK_MIN_SIZE > size)
+		size = TLSF_BLOCK_MIN_SIZE;
+
+	return (size + TLSF_ALIGNMENT - 1) & ~(size_t)(TLSF_ALIGNMENT - 1);
+}
+
+static void tlsf_remove_free (tlsf_block_t *block) {
+	size_t fl, sl;
+	tlsf_block_t *prev = block->prev_free, *next = block->next_free;
+
+	tlsf_mapping_insert (tlsf_block_size (block), &fl, &sl);
+
+	if (next)
+		next->prev_free = prev;
+	if (prev)
+		prev->next_free = next;
+	else
+		tlsf_blocks[fl][sl] = next;
+
+	if (!tlsf_blocks[fl][sl]) {
+		tlsf_sl_bitmap[fl] &= ~((uint32_t)1 << sl);
+		if (!tlsf_sl_bitmap[fl])
+			tlsf_fl_bitmap &= ~((uint32_t)1 << fl);
+	}
+}
+
+static void tlsf_insert_free (tlsf_block_t *block) {
+	size_t fl, sl;
+
+	tlsf_mapping_insert (tlsf_block_size (block), &fl, &sl);
+
+	block->prev_free = NULL;
+	block->next_free = tlsf_blocks[fl][sl];
+	if (block->next_free)
+		block->next_free->prev_free = block;
+	tlsf_blocks[fl][sl] = block;
+
+	tlsf_sl_bitmap[fl] |= (uint32_t)1 << sl;
+	tlsf_fl_bitmap |= (uint32_t)1 << fl;
+}
+
+// First block in the first non-empty list at or above the size's, or NULL.
+static tlsf_block_t *tlsf_find_free (size_t size) {
+	size_t fl, sl;
+
+	tlsf_mapping_insert (tlsf_mapping_round (size), &fl, &sl);
+	if (TLSF_FL_COUNT <= fl)
+		return NULL;
+
+	uint32_t sl_map = tlsf_sl_bitmap[fl] & (~(uint32_t)0 << sl);
+	if (!sl_map) {
+		const uint32_t fl_map = tlsf_fl_bitmap & (~(uint32_t)0 << (fl + 1));
+		if (!fl_map)
+			return NULL;
+
+		fl = __builtin_ctz (fl_map);
+		sl_map = tlsf_sl_bitmap[fl];
+	}
+
+	return tlsf_blocks[fl][__builtin_ctz (sl_map)];
+}
+
+// Give back the tail of a free block not in any list, if it is long enough for a block.
+static void tlsf_trim (tlsf_block_t *block, size_t size) {
+	if (tlsf_block_size (block) < size + TLSF_BLOCK_OVERHEAD + TLSF_BLOCK_MIN_SIZE)
+		return;
+
+	tlsf_block_t *remaining = tlsf_block_payload (block) + size;
+
+	remaining->size = tlsf_block_size (block) - size - TLSF_BLOCK_OVERHEAD;
+	block->size = size | (block->size & TLSF_BLOCK_FLAGS);
+
+	// The block before it is about to be used.
+	tlsf_block_mark_free (remaining);
+	tlsf_insert_free (remaining);
+}
+
+// Both must be free and out of the lists, next directly after block.
+static void tlsf_absorb (tlsf_block_t *block, tlsf_block_t *next) {
+	block->size += tlsf_block_size (next) + TLSF_BLOCK_OVERHEAD;
+	tlsf_block_link_next (block);
+}
+
+bool tlsf_add_pool (void *pool, size_t length) {
+	if ((size_t)pool % TLSF_ALIGNMENT) {
+		kputs ("mm/tlsf: Pool is not aligned!\n");
+		kpanic ();
+	}
+
+	length &= ~(size_t)(TLSF_ALIGNMENT - 1);
+	if (TLSF_POOL_OVERHEAD + TLSF_BLOCK_MIN_SIZE > length ||
+			TLSF_POOL_OVERHEAD + TLSF_MAX_SIZE < length)
+		return false;
+
+	tlsf_block_t *block = pool;
+	block->size = length - TLSF_POOL_OVERHEAD;
+
+	tlsf_block_t *end = tlsf_block_next (block);
+	end->size = 0;
+
+	const bool int_enabled = tlsf_lock_heap ();
+
+	tlsf_block_mark_free (block);
+	tlsf_insert_free (block);
+
+	tlsf_unlock_heap (int_enabled);
+
+	return true;
+}
+
+size_t tlsf_get_pool_size (size_t size) {
+	return tlsf_mapping_round (tlsf_adjust_size (size)) + TLSF_POOL_OVERHEAD;
+}
+
+void *tlsf_alloc (size_t size) {
+	if (!size || TLSF_MAX_SIZE < size)
+		return NULL;
+
+	size = tlsf_adjust_size (size);
+
+	const bool int_enabled = tlsf_lock_heap ();
+
+	tlsf_block_t *block = tlsf_find_free (size);
+	if (!block) {
+		tlsf_unlock_heap (int_enabled);
+		return NULL;  // ENOMEM
+	}
+
+	tlsf_remove_free (block);
+	tlsf_trim (block, size);
+	tlsf_block_mark_used (block);
+
+	tlsf_unlock_heap (int_enabled);
+
+	return tlsf_block_payload (block);
+}
+
+void tlsf_free (void *ptr) {
+	tlsf_block_t *block = tlsf_payload_block (ptr);
+
+	if (block->size & TLSF_BLOCK_FREE) {
+		kputs ("mm/tlsf: Attempted to free a free block!\n");
+		kpanic ();
+	}
+
+	const bool int_enabled = tlsf_lock_heap ();
+
+	tlsf_block_mark_free (block);
+
+	if (block->size & TLSF_BLOCK_PREV_FREE) {
+		tlsf_block_t *prev = block->prev_phys;
+
+		tlsf_remove_free (prev);
+		tlsf_absorb (prev, block);
+		block = prev;
+	}
+
+	tlsf_block_t *next = tlsf_block_next (block);
+	if (next->size & TLSF_BLOCK_FREE) {
+		tlsf_remove_free (next);
+		tlsf_absorb (block, next);
+	}
+
+	tlsf_insert_free (block);
+
+	tlsf_unlock_heap (int_enabled);
+}
+
+size_t tlsf_get_size (const void *ptr) {
+	return tlsf_block_size (tlsf_payload_block (ptr));
+}
+
+// vim: set ts=4 sw=4 noet syn=c:
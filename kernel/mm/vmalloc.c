@@ -0,0 +1,433 @@
+// kernel/mm/vmalloc.c
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdalign.h>
+
+#include <attributes.h>
+#include <collections/bintree.h>
+
+#include <kprint/kprint.h>
+#include <kpanic/kpanic.h>
+#include <mm/buddy.h>
+#include <mm/fault.h>
+#include <mm/page.h>
+#include <mm/paging.h>
+#include <mm/slab.h>
+#include <mm/tlb.h>
+#include <mm/vmalloc.h>
+#include <sched/spinlock.h>
+
+// Every area is a run of single pages from the buddy allocator mapped contiguously into
+// the window, followed by a guard page which is never mapped so running off the end of
+// an area faults instead of landing in the next one.  Areas are kept in a tree ordered
+// by their start address, so an address given to vfree is found exactly, and each node
+// carries the largest gap in its subtree so the lowest gap which fits is found in
+// O(log n).
+
+#define VMALLOC_GUARD_PAGES 1
+
+typedef struct vmalloc_area_data_struct {
+	size_t pages;
+	// Free pages after the guard page, up to the next area or the end of the window.
+	size_t gap;
+	// Largest gap in the subtree.
+	size_t max_gap;
+	// Pages are backed by the fault handler on first touch.
+	bool lazy;
+} vmalloc_area_data_t;
+
+TPL_BINTREE (vmalloc_area, vmalloc_area_data_t)
+
+static bintree_vmalloc_area_t
+	vmalloc_areas_base,
+	*vmalloc_areas = &vmalloc_areas_base;
+
+static kmem_cache_t *vmalloc_area_cache;
+
+static spinlock_t
+	vmalloc_lock_base,
+	*vmalloc_lock = &vmalloc_lock_base;
+
+static paging_data_t *vmalloc_paging_data = NULL;
+
+static size_t vmalloc_get_max_gap (bintree_vmalloc_area_node_t *area_node) {
+	return area_node ? area_node->data.max_gap : 0;
+}
+
+static void vmalloc_update (bintree_vmalloc_area_node_t *area_node) {
+	size_t max_gap = area_node->data.gap;
+
+	if (vmalloc_get_max_gap (area_node->low) > max_gap)
+		max_gap = vmalloc_get_max_gap (area_node->low);
+	if (vmalloc_get_max_gap (area_node->high) > max_gap)
+		max_gap = vmalloc_get_max_gap (area_node->high);
+
+	area_node->data.max_gap = max_gap;
+}
+
+CONSTRUCTOR
+static void vmalloc_construct () {
+	vmalloc_lock_base = new_spinlock ();
+	vmalloc_areas_base = new_bintree_vmalloc_area ();
+	vmalloc_areas_base.update = vmalloc_update;
+
+	vmalloc_area_cache = kmem_cache_create (
+		"vmalloc_area",
+		sizeof(bintree_vmalloc_area_node_t),
+		alignof(bintree_vmalloc_area_node_t),
+		NULL);
+	if (!vmalloc_area_cache) {
+		kputs ("mm/vmalloc: Failed to create area node cache!\n");
+		kpanic ();
+	}
+}
+
+static size_t vmalloc_get_pages (size_t size) {
+	return (size + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+static page_t *vmalloc_get_page (size_t start, size_t i) {
+	return (page_t *)(start + i * PAGE_SIZE);
+}
+
+// End of the area's guard page.
+static size_t vmalloc_area_end (bintree_vmalloc_area_node_t *area_node) {
+	return area_node->orderby + (area_node->data.pages + VMALLOC_GUARD_PAGES) * PAGE_SIZE;
+}
+
+// Recompute the gap after an area once it or its neighbours have changed.  Only its own
+// data changed, so rather than rebalancing only its path up to the root is updated.
+static void vmalloc_set_gap (bintree_vmalloc_area_node_t *area_node) {
+	bintree_vmalloc_area_iterator_t iterator_base, *iterator = &iterator_base;
+
+	iterator_base = new_bintree_vmalloc_area_iterator (area_node);
+	bintree_vmalloc_area_node_t *next_area_node = iterator->next (iterator);
+
+	const size_t limit = next_area_node ? next_area_node->orderby : (size_t)VMALLOC_END;
+
+	area_node->data.gap = (limit - vmalloc_area_end (area_node)) / PAGE_SIZE;
+
+	for (; area_node; area_node = area_node->parent)
+		vmalloc_update (area_node);
+}
+
+static void vmalloc_insert_area (bintree_vmalloc_area_node_t *area_node) {
+	bintree_vmalloc_area_iterator_t iterator_base, *iterator = &iterator_base;
+
+	vmalloc_areas->insert (vmalloc_areas, area_node);
+	vmalloc_set_gap (area_node);
+
+	iterator_base = new_bintree_vmalloc_area_iterator (area_node);
+	bintree_vmalloc_area_node_t *prev_area_node = iterator->prev (iterator);
+	if (prev_area_node)
+		vmalloc_set_gap (prev_area_node);
+}
+
+static void vmalloc_remove_area (bintree_vmalloc_area_node_t *area_node) {
+	bintree_vmalloc_area_iterator_t iterator_base, *iterator = &iterator_base;
+
+	iterator_base = new_bintree_vmalloc_area_iterator (area_node);
+	bintree_vmalloc_area_node_t *prev_area_node = iterator->prev (iterator);
+
+	vmalloc_areas->remove (vmalloc_areas, area_node);
+	if (prev_area_node)
+		vmalloc_set_gap (prev_area_node);
+}
+
+static void vmalloc_map_page (page_t *virtual, page_t *physical) {
+	page_attrs_t attrs = {
+		.present = true,
+		.writable = true,
+		.user = false,
+		.write_through = false,
+		.cache_disabled = false,
+		.accessed = false,
+		.dirty = false,
+		.global = tlb_global_supported ()
+	};
+
+	// The page wasn't present, so the range call has nothing to flush.
+	paging_map_range (virtual, physical, 1, attrs, vmalloc_paging_data);
+}
+
+static void vmalloc_release (size_t start, size_t first, size_t last) {
+	size_t i;
+
+	if (first == last)
+		return;
+
+	const page_attrs_t attrs = {
+		.present = false,
+		.writable = false,
+		.user = false,
+		.write_through = false,
+		.cache_disabled = false,
+		.accessed = false,
+		.dirty = false,
+		.global = false
+	};
+
+	// Pages are only returned once nothing can still reach them through the TLB.
+	paging_protect_range (
+		vmalloc_get_page (start, first), last - first, attrs, vmalloc_paging_data);
+
+	// Unmapping keeps the frames in the entries.  Pages of lazy areas which were never
+	// backed were mapped to NULL when the area was added.
+	for (i = first; last > i; ++i) {
+		page_t *physical =
+			paging_get_map (vmalloc_get_page (start, i), vmalloc_paging_data);
+
+		if (physical)
+			buddy_free (physical, 0);
+	}
+}
+
+// Back pages first through last of the area at start with fresh physical pages.
+static bool vmalloc_populate (size_t start, size_t first, size_t last, bool zeroed) {
+	size_t i;
+
+	for (i = first; last > i; ++i) {
+		page_t *physical = zeroed ? buddy_alloc_zeroed (0) : buddy_alloc (0);
+		if (!physical) {
+			vmalloc_release (start, first, i);
+			return false;
+		}
+
+		vmalloc_map_page (vmalloc_get_page (start, i), physical);
+	}
+
+	return true;
+}
+
+// Lowest gap in the window which will fit the pages and a guard page, or zero if there
+// is none.
+static size_t vmalloc_find_gap (size_t pages) {
+	bintree_vmalloc_area_node_t *area_node = vmalloc_areas->min (vmalloc_areas);
+	const size_t needed = pages + VMALLOC_GUARD_PAGES;
+
+	// The gap before the first area belongs to no node.
+	const size_t first = area_node ? area_node->orderby : (size_t)VMALLOC_END;
+	if ((first - (size_t)VMALLOC_START) / PAGE_SIZE >= needed)
+		return (size_t)VMALLOC_START;
+
+	area_node = vmalloc_areas->root;
+	if (vmalloc_get_max_gap (area_node) < needed)
+		return 0;
+
+	// Areas below come first, so take the low side whenever it has a gap which fits.
+	for (;;) {
+		if (vmalloc_get_max_gap (area_node->low) >= needed)
+			area_node = area_node->low;
+		else if (area_node->data.gap >= needed)
+			return vmalloc_area_end (area_node);
+		else
+			area_node = area_node->high;
+	}
+}
+
+static bintree_vmalloc_area_node_t *vmalloc_get_area (const void *ptr) {
+	bintree_vmalloc_area_node_t *area_node =
+		vmalloc_areas->search (vmalloc_areas, (size_t)ptr);
+
+	if (!area_node || (size_t)ptr != area_node->orderby) {
+		kputs ("mm/vmalloc: Pointer is not the start of an area!\n");
+		kpanic ();
+	}
+
+	return area_node;
+}
+
+void vmalloc_init () {
+	paging_data_t *paging_data = paging_get_kernel_data ();
+	page_t *table;
+
+	if (!paging_data) {
+		kputs ("mm/vmalloc: Paging must be enabled before vmalloc is initialized!\n");
+		kpanic ();
+	}
+
+	// Tables are only created here by vmalloc, anything else in the window means the
+	// window is already in use.
+	for (table = VMALLOC_START; (page_t *)VMALLOC_END > table; table += 1024) {
+		if (paging_table_present (table, paging_data)) {
+			kputs ("mm/vmalloc: Window is already mapped, vmalloc is disabled.\n");
+			return;
+		}
+	}
+
+	vmalloc_paging_data = paging_data;
+}
+
+bool vmalloc_is_init () {
+	return NULL != vmalloc_paging_data;
+}
+
+static void *vmalloc_area (size_t size, bool lazy, bool zeroed) {
+	bintree_vmalloc_area_node_t *area_node;
+
+	if (!size || !vmalloc_is_init ())
+		return NULL;
+
+	const vmalloc_area_data_t data = {
+		.pages = vmalloc_get_pages (size),
+		.gap = 0,
+		.max_gap = 0,
+		.lazy = lazy
+	};
+
+	area_node = kmem_cache_alloc (vmalloc_area_cache);
+	if (!area_node)
+		return NULL;
+
+	spinlock_lock (vmalloc_lock);
+
+	const size_t start = vmalloc_find_gap (data.pages);
+	const bool success = start && (lazy ?
+		fault_add_lazy_area ((void *)start, data.pages * PAGE_SIZE) :
+		vmalloc_populate (start, 0, data.pages, zeroed));
+	if (!success) {
+		spinlock_release (vmalloc_lock);
+		kmem_cache_free (vmalloc_area_cache, area_node);
+		return NULL;  // ENOMEM
+	}
+
+	*area_node = new_bintree_vmalloc_area_node (data, start);
+	vmalloc_insert_area (area_node);
+
+	spinlock_release (vmalloc_lock);
+
+	return (void *)start;
+}
+
+void *vmalloc (size_t size) {
+	return vmalloc_area (size, false, false);
+}
+
+void *vzalloc (size_t size) {
+	return vmalloc_area (size, false, true);
+}
+
+void *vmalloc_lazy (size_t size) {
+	return vmalloc_area (size, true, false);
+}
+
+void *vrealloc (void *ptr, size_t size) {
+	bintree_vmalloc_area_node_t *area_node;
+
+	if (!ptr)
+		return vmalloc (size);
+
+	if (!size)
+		return NULL;
+
+	const size_t pages = vmalloc_get_pages (size);
+
+	spinlock_lock (vmalloc_lock);
+
+	area_node = vmalloc_get_area (ptr);
+	const size_t start = area_node->orderby;
+	const size_t old_pages = area_node->data.pages;
+
+	// The fault handler's area can't be resized.
+	if (area_node->data.lazy) {
+		spinlock_release (vmalloc_lock);
+		return NULL;
+	}
+
+	if (pages <= old_pages) {
+		vmalloc_release (start, pages, old_pages);
+		area_node->data.pages = pages;
+		vmalloc_set_gap (area_node);
+
+		spinlock_release (vmalloc_lock);
+		return ptr;
+	}
+
+	// Grow in place, the guard page moves up with the end of the area.
+	if (area_node->data.gap >= pages - old_pages) {
+		if (!vmalloc_populate (start, old_pages, pages, false)) {
+			spinlock_release (vmalloc_lock);
+			return NULL;  // ENOMEM
+		}
+
+		area_node->data.pages = pages;
+		vmalloc_set_gap (area_node);
+
+		spinlock_release (vmalloc_lock);
+		return ptr;
+	}
+
+	// The area still occupies its old place, so the gap can't overlap it.
+	const size_t new_start = vmalloc_find_gap (pages);
+	if (!new_start || !vmalloc_populate (new_start, old_pages, pages, false)) {
+		spinlock_release (vmalloc_lock);
+		return NULL;  // ENOMEM
+	}
+
+	// Move the existing pages rather than their contents, the old range is unmapped and
+	// flushed at once afterwards.
+	size_t i;
+	for (i = 0; old_pages > i; ++i) {
+		page_t *virtual = vmalloc_get_page (start, i);
+		vmalloc_map_page (
+			vmalloc_get_page (new_start, i), paging_get_map (virtual, vmalloc_paging_data));
+	}
+
+	const page_attrs_t attrs = {
+		.present = false,
+		.writable = false,
+		.user = false,
+		.write_through = false,
+		.cache_disabled = false,
+		.accessed = false,
+		.dirty = false,
+		.global = false
+	};
+
+	paging_protect_range (vmalloc_get_page (start, 0), old_pages, attrs, vmalloc_paging_data);
+
+	vmalloc_remove_area (area_node);
+	area_node->data.pages = pages;
+	*area_node = new_bintree_vmalloc_area_node (area_node->data, new_start);
+	vmalloc_insert_area (area_node);
+
+	spinlock_release (vmalloc_lock);
+
+	return (void *)new_start;
+}
+
+void vfree (void *ptr) {
+	bintree_vmalloc_area_node_t *area_node;
+
+	spinlock_lock (vmalloc_lock);
+
+	area_node = vmalloc_get_area (ptr);
+
+	// No more pages may be backed once the area is being released.
+	if (area_node->data.lazy)
+		fault_remove_lazy_area (ptr);
+
+	vmalloc_release (area_node->orderby, 0, area_node->data.pages);
+	vmalloc_remove_area (area_node);
+
+	spinlock_release (vmalloc_lock);
+
+	kmem_cache_free (vmalloc_area_cache, area_node);
+}
+
+bool vmalloc_owns (const void *ptr) {
+	return VMALLOC_START <= ptr && VMALLOC_END > ptr;
+}
+
+size_t vmalloc_get_size (const void *ptr) {
+	spinlock_lock (vmalloc_lock);
+
+	const size_t size = vmalloc_get_area (ptr)->data.pages * PAGE_SIZE;
+
+	spinlock_release (vmalloc_lock);
+
+	return size;
+}
+
+// vim: set ts=4 sw=4 noet syn=c:
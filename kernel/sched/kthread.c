@@ -1,10 +1,15 @@
 // kernel/sched/kthread.c
 
+#include <stdalign.h>
+
 #include <attributes.h>
 #include <collections/linked_list.h>
 #include <collections/bintree.h>
 
+#include <mm/buddy.h>
+#include <mm/fault.h>
 #include <mm/malloc.h>
+#include <mm/slab.h>
 #include <kprint/kprint.h>
 #include <kpanic/kpanic.h>
 #include <asm/halt.h>
@@ -12,17 +17,34 @@
 #include <sched/kthread_kpid.h>
 #include <sched/kthread_task.h>
 #include <sched/kthread_preempt.h>
+#include <time/clock.h>
 
 // We've added a lot of optimizations here because it's very important
 // for preemptive multitasking that task switches themselves be very very fast.
 
 #define KTHREAD_MAIN_KPID 2
 
+// A thread waking from a long sleep is put no further than this behind the others, so it
+// can't bank its sleep and then hold the CPU to catch up.
+#define KTHREAD_FAIR_SLEEPER_CREDIT ((clock_t)5000)
+// Keys of the fair tree are kept relative to a base, and moved down whenever the oldest
+// would no longer fit a size_t comfortably.
+#define KTHREAD_FAIR_REBASE ((clock_t)1 << 30)
+
 typedef struct kthread_lock_struct {
 	native_lock_t native_lock;
 	size_t depth;
 } kthread_lock_t;
 
+typedef struct kthread_sleeper_struct {
+	time_t until;
+	kpid_t kpid;
+	// Still in kthreads_sleeping, false once woken by the clock.
+	bool queued;
+} kthread_sleeper_t;
+
+TPL_LINKED_LIST(kthread_sleeper, kthread_sleeper_t);
+
 typedef struct bintree_kthread_node_struct bintree_kthread_node_t;
 typedef struct kthread_struct {
 	kpid_t kpid;
@@ -30,7 +52,14 @@ typedef struct kthread_struct {
 	freemem_region_t stack_region;
 	kthread_task_t task;
 	kthread_lock_t lock;
+	kthread_priority_t priority;
+	kthread_nice_t nice;
+	// Microseconds run for, and the same scaled by the inverse of the weight.
+	clock_t runtime;
+	clock_t vruntime;
 	bintree_kthread_node_t *blocking_node;
+	bintree_kthread_node_t *fair_node;
+	linked_list_kthread_sleeper_node_t sleeper_node;
 } kthread_t;
 
 static kthread_lock_t new_kthread_lock () {
@@ -46,7 +75,8 @@ static kthread_t new_kthread (
 		kpid_t kpid,
 		kpid_t parent,
 		freemem_region_t stack_region,
-		kthread_task_t task
+		kthread_task_t task,
+		kthread_priority_t priority
 ) {
 	kthread_t kthread = {
 		.kpid = kpid,
@@ -54,7 +84,17 @@ static kthread_t new_kthread (
 		.stack_region = stack_region,
 		.task = task,
 		.lock = new_kthread_lock (),
-		.blocking_node = NULL
+		.priority = priority,
+		.nice = KTHREAD_NICE_DEFAULT,
+		.runtime = 0,
+		.vruntime = 0,
+		.blocking_node = NULL,
+		.fair_node = NULL,
+		.sleeper_node = new_linked_list_kthread_sleeper_node ((kthread_sleeper_t){
+			.until = 0,
+			.kpid = kpid,
+			.queued = false
+		})
 	};
 
 	return kthread;
@@ -71,9 +111,34 @@ TPL_BINTREE(kthread, linked_list_kthread_node_t *);
 
 static bool kthread_init_record = false;
 
-static volatile linked_list_kthread_t
-	kthreads_active_base,
-	*kthreads_active = &kthreads_active_base;
+// A queue of runnable threads for every priority, and a bit for every non-empty queue so
+// the highest is found with a single bsr.
+static volatile linked_list_kthread_t kthreads_active[KTHREAD_PRIORITIES];
+static volatile unsigned int kthreads_active_levels = 0;
+
+// Threads runnable at KTHREAD_PRIORITY_FAIR, by vruntime less kthread_fair_base.
+static volatile bintree_kthread_t
+	kthreads_fair_base,
+	*kthreads_fair = &kthreads_fair_base;
+static clock_t kthread_fair_base = 0;
+// Never goes back, the vruntime of the last fair thread to be picked if it was the most.
+static clock_t kthread_fair_min_vruntime = 0;
+
+// 2^22 * 1.25^nice, so that the weight at the default niceness is one.
+static const uint32_t kthread_fair_inv_weights[KTHREAD_NICE_MAX - KTHREAD_NICE_MIN + 1] = {
+	48357, 60446, 75558, 94447, 118059,
+	147574, 184467, 230584, 288230, 360288,
+	450360, 562950, 703687, 879609, 1099512,
+	1374390, 1717987, 2147484, 2684355, 3355443,
+	4194304, 5242880, 6553600, 8192000, 10240000,
+	12800000, 16000000, 20000000, 25000000, 31250000,
+	39062500, 48828125, 61035156, 76293945, 95367432,
+	119209290, 149011612, 186264515, 232830644, 291038305
+};
+
+// When the running thread was switched to.
+static clock_t kthread_last_switch = 0;
+
 static volatile linked_list_kthread_t
 	kthreads_destroy_base,
 	*kthreads_destroy = &kthreads_destroy_base;
@@ -82,10 +147,18 @@ static volatile bintree_kthread_t
 	kthreads_blocking_base,
 	*kthreads_blocking = &kthreads_blocking_base;
 
+// Sleeping threads, soonest to wake first.  Every one is also blocking.
+static volatile linked_list_kthread_sleeper_t
+	kthreads_sleeping_base,
+	*kthreads_sleeping = &kthreads_sleeping_base;
+
 static volatile bintree_kpid_t
 	kpids_free_base,
 	*kpids_free = &kpids_free_base;
 
+static kmem_cache_t *kthread_node_cache;
+static kmem_cache_t *kthread_blocking_node_cache;
+
 volatile linked_list_kthread_node_t *volatile kthread_running_node = NULL;
 volatile kpid_t kthread_destroy_task_kpid = -1;
 volatile kpid_t kthread_idle_task_kpid = -1;
@@ -109,8 +182,220 @@ static volatile kthread_lock_t *kthread_get_running_lock () {
 	return &kthread_running_thread->lock;
 }
 
-static freemem_region_t kthread_stack_alloc () {
-	freemem_region_t stack_region = freemem_alloc (KTHREAD_STACK_SIZE, PAGE_SIZE, 0);
+// Charge the running thread for the time since it was switched to.
+// Task must already be locked!
+FAST HOT
+static void kthread_update_runtime () {
+	volatile kthread_t *running_thread = kthread_get_running_thread ();
+	const clock_t now = clock_get_ticks ();
+	const clock_t delta = now - kthread_last_switch;
+
+	kthread_last_switch = now;
+
+	running_thread->runtime += delta;
+	running_thread->vruntime +=
+		delta * kthread_fair_inv_weights[running_thread->nice - KTHREAD_NICE_MIN] >> 22;
+}
+
+// Move every key down, keeping their order, so new keys don't overflow.  Threads queued
+// since before the minimum passed them may be behind the new base, their keys are
+// clamped to the start rather than wrapping around to the end.
+static void kthread_fair_rebase () {
+	bintree_kthread_iterator_t iterator_base, *iterator = &iterator_base;
+	bintree_kthread_node_t *fair_node;
+	size_t key = 0;
+	bool first = true;
+
+	const clock_t base = kthread_fair_min_vruntime - KTHREAD_FAIR_SLEEPER_CREDIT;
+	const size_t delta = base - kthread_fair_base;
+
+	fair_node = kthreads_fair->min ((bintree_kthread_t *)kthreads_fair);
+	iterator_base = new_bintree_kthread_iterator (fair_node);
+
+	// Keys are visited in order, each must stay above the last to remain unique.
+	for (; fair_node; fair_node = iterator->next (iterator)) {
+		size_t shifted = fair_node->orderby < delta ? 0 : fair_node->orderby - delta;
+
+		if (!first && shifted <= key)
+			shifted = key + 1;
+
+		fair_node->orderby = key = shifted;
+		first = false;
+	}
+
+	kthread_fair_base = base;
+}
+
+// Task must already be locked!
+static void kthread_fair_enqueue (volatile linked_list_kthread_node_t *kthread_node) {
+	volatile kthread_t *kthread = &kthread_node->data;
+	bintree_kthread_node_t *fair_node = kthread->fair_node;
+
+	if (kthread->vruntime + KTHREAD_FAIR_SLEEPER_CREDIT < kthread_fair_min_vruntime)
+		kthread->vruntime = kthread_fair_min_vruntime - KTHREAD_FAIR_SLEEPER_CREDIT;
+
+	if (kthread_fair_min_vruntime - kthread_fair_base > KTHREAD_FAIR_REBASE)
+		kthread_fair_rebase ();
+
+	*fair_node = new_bintree_kthread_node (
+		(linked_list_kthread_node_t *)kthread_node,
+		(size_t)(kthread->vruntime - kthread_fair_base));
+
+	// Keys must be unique, a microsecond either way makes no difference.
+	while (kthreads_fair->insert ((bintree_kthread_t *)kthreads_fair, fair_node))
+		fair_node->orderby += 1;
+}
+
+// A contended pop passes over the running thread, which has just been queued while it
+// waits on another, unless it is the only one.
+// Task must already be locked!
+static volatile linked_list_kthread_node_t *kthread_fair_pop (bool contended) {
+	bintree_kthread_iterator_t iterator_base, *iterator = &iterator_base;
+	bintree_kthread_node_t *fair_node =
+		kthreads_fair->min ((bintree_kthread_t *)kthreads_fair);
+
+	if (contended && kthread_running_node == fair_node->data) {
+		iterator_base = new_bintree_kthread_iterator (fair_node);
+
+		if (iterator->next (iterator))
+			fair_node = iterator->cur (iterator);
+	}
+
+	kthreads_fair->remove ((bintree_kthread_t *)kthreads_fair, fair_node);
+
+	volatile linked_list_kthread_node_t *kthread_node = fair_node->data;
+
+	if (kthread_node->data.vruntime > kthread_fair_min_vruntime)
+		kthread_fair_min_vruntime = kthread_node->data.vruntime;
+
+	return kthread_node;
+}
+
+// Task must already be locked!
+FAST HOT
+static void kthread_activate (volatile linked_list_kthread_node_t *kthread_node) {
+	const kthread_priority_t priority = kthread_node->data.priority;
+	volatile linked_list_kthread_t *queue = &kthreads_active[priority];
+
+	if (KTHREAD_PRIORITY_FAIR == priority)
+		kthread_fair_enqueue (kthread_node);
+	else
+		queue->append (
+			(linked_list_kthread_t *)queue, (linked_list_kthread_node_t *)kthread_node);
+
+	kthreads_active_levels |= 1u << priority;
+}
+
+// A contended pop passes over the running thread's own level if any other has a thread,
+// the lock it is waiting on may be held below it by a thread which would otherwise never
+// run.
+// Task must already be locked!
+FAST HOT
+static volatile linked_list_kthread_node_t *kthread_pop_active (bool contended) {
+	unsigned int levels = kthreads_active_levels;
+
+	if (!levels)
+		return NULL;
+
+	if (contended) {
+		const kthread_priority_t priority = kthread_get_running_thread ()->priority;
+		const unsigned int other_levels = levels & ~(1u << priority);
+
+		if (other_levels)
+			levels = other_levels;
+	}
+
+	const unsigned int priority = 8 * sizeof(unsigned int) - 1 - __builtin_clz (levels);
+	volatile linked_list_kthread_t *queue = &kthreads_active[priority];
+
+	if (KTHREAD_PRIORITY_FAIR == priority) {
+		volatile linked_list_kthread_node_t *kthread_node = kthread_fair_pop (contended);
+
+		if (!kthreads_fair->root)
+			kthreads_active_levels &= ~(1u << priority);
+
+		return kthread_node;
+	}
+
+	volatile linked_list_kthread_node_t *kthread_node =
+		queue->pop ((linked_list_kthread_t *)queue);
+
+	if (!queue->start)
+		kthreads_active_levels &= ~(1u << priority);
+
+	return kthread_node;
+}
+
+// Task must already be locked!
+static void kthread_deactivate (volatile linked_list_kthread_node_t *kthread_node) {
+	const kthread_priority_t priority = kthread_node->data.priority;
+	volatile linked_list_kthread_t *queue = &kthreads_active[priority];
+
+	if (KTHREAD_PRIORITY_FAIR == priority) {
+		kthreads_fair->remove (
+			(bintree_kthread_t *)kthreads_fair, kthread_node->data.fair_node);
+
+		if (!kthreads_fair->root)
+			kthreads_active_levels &= ~(1u << priority);
+
+		return;
+	}
+
+	queue->removeNode ((linked_list_kthread_t *)queue, (linked_list_kthread_node_t *)kthread_node);
+
+	if (!queue->start)
+		kthreads_active_levels &= ~(1u << priority);
+}
+
+// Task must already be locked!
+static volatile linked_list_kthread_node_t *kthread_find_active (kpid_t kpid) {
+	linked_list_kthread_iterator_t iterator_base, *iterator = &iterator_base;
+	linked_list_kthread_node_t *kthread_node;
+	bintree_kthread_iterator_t fair_iterator_base, *fair_iterator = &fair_iterator_base;
+	bintree_kthread_node_t *fair_node;
+	size_t i;
+
+	fair_node = kthreads_fair->min ((bintree_kthread_t *)kthreads_fair);
+	fair_iterator_base = new_bintree_kthread_iterator (fair_node);
+
+	for (; fair_node; fair_node = fair_iterator->next (fair_iterator))
+		if (kpid == fair_node->data->data.kpid)
+			return fair_node->data;
+
+	for (i = 0; KTHREAD_PRIORITIES > i; ++i) {
+		volatile linked_list_kthread_t *queue = &kthreads_active[i];
+
+		iterator_base = queue->new_iterator ((linked_list_kthread_t *)queue);
+
+		for (kthread_node = iterator->cur (iterator); kthread_node;
+				kthread_node = iterator->next (iterator))
+			if (kpid == kthread_node->data.kpid)
+				return kthread_node;
+	}
+
+	return NULL;
+}
+
+// The running, blocking or runnable thread, and whether it is runnable.
+// Task must already be locked!
+static volatile linked_list_kthread_node_t *kthread_find (kpid_t kpid, bool *active) {
+	*active = false;
+
+	if (kthread_get_running_kpid () == kpid)
+		return kthread_running_node;
+
+	bintree_kthread_node_t *kthread_blocking_node =
+		kthreads_blocking->search ((bintree_kthread_t *)kthreads_blocking, kpid);
+	if (kthread_blocking_node && kpid == (kpid_t)kthread_blocking_node->orderby)
+		return kthread_blocking_node->data;
+
+	*active = true;
+
+	return kthread_find_active (kpid);
+}
+
+static freemem_region_t kthread_stack_alloc (kpid_t kpid) {
+	freemem_region_t stack_region = fault_stack_alloc (kpid, KTHREAD_STACK_SIZE);
 	if (!stack_region.length) {
 		kputs ("sched/kthread: Failed to allocate new kthread stack!\n");
 		kpanic ();
@@ -120,6 +405,12 @@ static freemem_region_t kthread_stack_alloc () {
 }
 
 static void kthread_stack_free (freemem_region_t stack_region) {
+	// The main thread runs on the boot stack, which belongs to freemem.
+	if (fault_stack_owns (stack_region.p)) {
+		fault_stack_free (stack_region.p);
+		return;
+	}
+
 	const bool add_success = freemem_add_region (stack_region);
 	if (!add_success) {
 		kputs ("sched/kthread: Failed to deallocate kthread stack region!\n");
@@ -128,20 +419,24 @@ static void kthread_stack_free (freemem_region_t stack_region) {
 }
 
 static linked_list_kthread_node_t *kthread_node_alloc (kthread_t kthread) {
-	linked_list_kthread_node_t *kthread_node =
-		malloc (sizeof(linked_list_kthread_node_t));
+	linked_list_kthread_node_t *kthread_node = kmem_cache_alloc (kthread_node_cache);
 	if (!kthread_node) {
 		kputs ("sched/kthread: Failed to allocate new kthread!\n");
 		kpanic ();
 	}
 
-	kthread.blocking_node =
-		malloc (sizeof(bintree_kthread_node_t));
+	kthread.blocking_node = kmem_cache_alloc (kthread_blocking_node_cache);
 	if (!kthread.blocking_node) {
 		kputs ("sched/kthread: Failed to allocate new blocking node!\n");
 		kpanic ();
 	}
 
+	kthread.fair_node = kmem_cache_alloc (kthread_blocking_node_cache);
+	if (!kthread.fair_node) {
+		kputs ("sched/kthread: Failed to allocate new fair node!\n");
+		kpanic ();
+	}
+
 	*kthread_node = new_linked_list_kthread_node (kthread);
 	*kthread_node->data.blocking_node = new_bintree_kthread_node (
 		(linked_list_kthread_node_t *)kthread_node,
@@ -181,7 +476,7 @@ static kpid_t kthread_pop_free_kpid () {
 
 	kthread_unlock_task ();
 
-	free (kpid_node);
+	free_sized (kpid_node, sizeof(bintree_kpid_node_t));
 
 	return kpid;
 }
@@ -189,11 +484,15 @@ static kpid_t kthread_pop_free_kpid () {
 static linked_list_kthread_node_t *kthread_create_thread (
 		kpid_t kpid,
 		kpid_t parent,
-		void (*entry) ()
+		void (*entry) (),
+		kthread_priority_t priority
 ) {
-	freemem_region_t stack_region = kthread_stack_alloc ();
+	freemem_region_t stack_region = kthread_stack_alloc (kpid);
 	kthread_task_t task = new_kthread_task (entry, freemem_region_end (stack_region));
-	kthread_t kthread = new_kthread (kpid, parent, stack_region, task);
+	kthread_t kthread = new_kthread (kpid, parent, stack_region, task, priority);
+
+	// Start level with the fair threads rather than ahead of them all.
+	kthread.vruntime = kthread_fair_min_vruntime;
 
 	linked_list_kthread_node_t *kthread_node = kthread_node_alloc (kthread);
 
@@ -204,7 +503,8 @@ static linked_list_kthread_node_t *kthread_create_main_thread (
 		freemem_region_t main_stack_region
 ) {
 	kthread_task_t main_task = new_kthread_task_from_running ();
-	kthread_t kthread = new_kthread (KTHREAD_MAIN_KPID, 0, main_stack_region, main_task);
+	kthread_t kthread = new_kthread (
+		KTHREAD_MAIN_KPID, 0, main_stack_region, main_task, KTHREAD_PRIORITY_DEFAULT);
 
 	linked_list_kthread_node_t *kthread_node = kthread_node_alloc (kthread);
 
@@ -212,7 +512,8 @@ static linked_list_kthread_node_t *kthread_create_main_thread (
 }
 
 static bintree_kpid_node_t *kthread_kpid_node_alloc (kpid_t kpid) {
-	bintree_kpid_node_t *kpid_node = malloc (sizeof(bintree_kpid_node_t));
+	bintree_kpid_node_t *kpid_node = aligned_alloc (
+		alignof(bintree_kpid_node_t), sizeof(bintree_kpid_node_t));
 	if (!kpid_node) {
 		kputs ("sched/kthread: Failed to allocate free kpid entry!\n");
 		kpanic ();
@@ -230,8 +531,9 @@ static void kthread_destroy_thread (linked_list_kthread_node_t *kthread_node) {
 
 	kpid_t kpid = kthread_node->data.kpid;
 
-	free (kthread_node->data.blocking_node);
-	free (kthread_node);
+	kmem_cache_free (kthread_blocking_node_cache, kthread_node->data.blocking_node);
+	kmem_cache_free (kthread_blocking_node_cache, kthread_node->data.fair_node);
+	kmem_cache_free (kthread_node_cache, kthread_node);
 
 	bintree_kpid_node_t *kpid_node = kthread_kpid_node_alloc (kpid);
 
@@ -248,9 +550,11 @@ static void kthread_destroy_thread (linked_list_kthread_node_t *kthread_node) {
 
 // Task must already be locked!
 FAST HOT
-static void kthread_next_task (volatile kthread_task_t *this_task) {
+static void kthread_next_task (volatile kthread_task_t *this_task, bool contended) {
+	kthread_update_runtime ();
+
 	volatile linked_list_kthread_node_t *next_kthread_node =
-		kthreads_active->pop ((linked_list_kthread_t *)kthreads_active);
+		kthread_pop_active (contended);
 
 	if (next_kthread_node) {
 		if (kthread_get_running_kpid () == next_kthread_node->data.kpid)
@@ -269,7 +573,7 @@ static void kthread_next_task (volatile kthread_task_t *this_task) {
 		// If there is nothing to do wake idle task and run it.
 		kthread_wake (kthread_idle_task_kpid);
 
-		kthread_next_task (this_task);
+		kthread_next_task (this_task, contended);
 	}
 }
 
@@ -323,9 +627,15 @@ static void kthread_background_task_idle () {
 		kthread_preempt_slow ();
 
 		for (;;) {
-			// Then just halt, until needed again.
-			while (!kthreads_active->start)
-				halt ();
+			// Zero pages ahead of time a page at a time, so new work is noticed quickly,
+			// then just halt, until needed again.
+			while (!kthreads_active_levels) {
+				// The clock can't wake sleepers while this task holds the lock.
+				kthread_wake_sleepers ();
+
+				if (!kthreads_active_levels && !buddy_fill_zeroed ())
+					halt ();
+			}
 
 			// Return to normal preemption rate.
 			kthread_preempt_fast ();
@@ -334,7 +644,7 @@ static void kthread_background_task_idle () {
 			kthread_block ();
 
 			// Set low preemption rate again.
-			if (!kthreads_active->start)
+			if (!kthreads_active_levels)
 				break;
 		}
 	}
@@ -360,10 +670,29 @@ static void kthread_background_task_destroy () {
 
 COLD
 void kthread_init (freemem_region_t main_stack_region) {
-	*kthreads_active = new_linked_list_kthread ();
+	kthread_node_cache = kmem_cache_create (
+		"kthread",
+		sizeof(linked_list_kthread_node_t),
+		alignof(linked_list_kthread_node_t),
+		NULL);
+	kthread_blocking_node_cache = kmem_cache_create (
+		"kthread_blocking",
+		sizeof(bintree_kthread_node_t),
+		alignof(bintree_kthread_node_t),
+		NULL);
+	if (!kthread_node_cache || !kthread_blocking_node_cache) {
+		kputs ("sched/kthread: Failed to create kthread caches!\n");
+		kpanic ();
+	}
+
+	size_t i;
+	for (i = 0; KTHREAD_PRIORITIES > i; ++i)
+		kthreads_active[i] = new_linked_list_kthread ();
 	*kthreads_destroy = new_linked_list_kthread ();
 
 	*kthreads_blocking = new_bintree_kthread ();
+	*kthreads_fair = new_bintree_kthread ();
+	*kthreads_sleeping = new_linked_list_kthread_sleeper ();
 
 	*kpids_free = new_bintree_kpid ();
 
@@ -378,16 +707,18 @@ void kthread_init (freemem_region_t main_stack_region) {
 	kthread_init_record = true;
 
 	// Start the idle background task in the blocking state.
-	kthread_idle_task_kpid =
-		kthread_new_blocking_task (kthread_background_task_idle);
+	kthread_idle_task_kpid = kthread_new_blocking_task (
+		kthread_background_task_idle, KTHREAD_PRIORITY_MIN);
 	if (0 > kthread_idle_task_kpid) {
 		kputs ("sched/kthread: Failed to create idle background task!\n");
 		kpanic ();
 	}
 
 	// Start the destruction background task in the blocking state.
-	kthread_destroy_task_kpid =
-		kthread_new_blocking_task (kthread_background_task_destroy);
+	// Destroying a thread takes the allocators' locks, which threads at any level may be
+	// waiting on, so this doesn't run below them.
+	kthread_destroy_task_kpid = kthread_new_blocking_task (
+		kthread_background_task_destroy, KTHREAD_PRIORITY_DEFAULT);
 	if (0 > kthread_destroy_task_kpid) {
 		kputs ("sched/kthread: Failed to create destroy background task!\n");
 		kpanic ();
@@ -405,31 +736,35 @@ bool kthread_is_init () {
 	return kthread_init_record;
 }
 
-kpid_t kthread_new_task (void (*entry) ()) {
+kpid_t kthread_new_task (void (*entry) (), kthread_priority_t priority) {
+	if (KTHREAD_PRIORITY_MAX < priority)
+		return -1;
+
 	kpid_t new_kpid = kthread_pop_free_kpid ();
 	if (0 > new_kpid)
 		return -1;
 
 	linked_list_kthread_node_t *new_kthread_node =
-		kthread_create_thread (new_kpid, kthread_get_running_kpid (), entry);
+		kthread_create_thread (new_kpid, kthread_get_running_kpid (), entry, priority);
 
 	kthread_lock_task ();
-	kthreads_active->append (
-		(linked_list_kthread_t *)kthreads_active,
-		new_kthread_node);
+	kthread_activate (new_kthread_node);
 	kthread_unlock_task ();
 
 	return new_kpid;
 }
 
 // Start task in the blocking state.
-kpid_t kthread_new_blocking_task (void (*entry) ()) {
+kpid_t kthread_new_blocking_task (void (*entry) (), kthread_priority_t priority) {
+	if (KTHREAD_PRIORITY_MAX < priority)
+		return -1;
+
 	kpid_t new_kpid = kthread_pop_free_kpid ();
 	if (0 > new_kpid)
 		return -1;
 
 	linked_list_kthread_node_t *new_blocking_kthread_node =
-		kthread_create_thread (new_kpid, kthread_get_running_kpid (), entry);
+		kthread_create_thread (new_kpid, kthread_get_running_kpid (), entry, priority);
 
 	kthread_add_blocking_node (new_blocking_kthread_node);
 
@@ -453,23 +788,30 @@ void kthread_end_task () {
 		*ignored_task = &ignored_task_base;
 
 	for (;;)  // Avoid compiler warning about "noreturn" functions returning.
-		kthread_next_task (ignored_task);
+		kthread_next_task (ignored_task, false);
 }
 
-FAST HOT
-void kthread_yield () {
+static void kthread_do_yield (bool contended) {
 	// Lock must be held through switch or else we could end up in kthreads active twice.
 	kthread_lock_task ();
 
-	kthreads_active->append (
-		(linked_list_kthread_t *)kthreads_active,
-		(linked_list_kthread_node_t *)kthread_running_node);
+	// Runtime must be up to date before the thread is queued by it.
+	kthread_update_runtime ();
+	kthread_activate (kthread_running_node);
 
-	kthread_next_task (kthread_get_running_task ());
+	kthread_next_task (kthread_get_running_task (), contended);
 
 	kthread_unlock_task ();
 }
 
+void kthread_yield () {
+	kthread_do_yield (false);
+}
+
+void kthread_yield_contended () {
+	kthread_do_yield (true);
+}
+
 bool kthread_wake (kpid_t kpid) {
 	// Lock atleast until removal from blocking tree.
 	kthread_lock_task ();
@@ -491,9 +833,7 @@ bool kthread_wake (kpid_t kpid) {
 		(bintree_kthread_t *)kthreads_blocking,
 		kthread_blocking_node);
 
-	kthreads_active->append (
-		(linked_list_kthread_t *)kthreads_active,
-		kthread_node);
+	kthread_activate (kthread_node);
 
 	kthread_unlock_task ();
 
@@ -504,10 +844,72 @@ void kthread_block () {
 	kthread_add_blocking_node (kthread_running_node);
 
 	kthread_lock_task ();
-	kthread_next_task (kthread_get_running_task ());
+	kthread_next_task (kthread_get_running_task (), false);
 	kthread_unlock_task ();
 }
 
+void kthread_sleep_until (time_t until) {
+	linked_list_kthread_sleeper_iterator_t iterator_base, *iterator = &iterator_base;
+	linked_list_kthread_sleeper_node_t *sleeper_node, *cur_sleeper_node;
+	size_t i = 0;
+
+	// Lock until the task switch, so the clock can't wake this before it is blocking.
+	kthread_lock_task ();
+
+	sleeper_node =
+		(linked_list_kthread_sleeper_node_t *)&kthread_running_node->data.sleeper_node;
+	sleeper_node->data.until = until;
+	sleeper_node->data.queued = true;
+
+	iterator_base = kthreads_sleeping->new_iterator (
+		(linked_list_kthread_sleeper_t *)kthreads_sleeping);
+
+	for (cur_sleeper_node = iterator->cur (iterator); cur_sleeper_node;
+			cur_sleeper_node = iterator->next (iterator), ++i)
+		if (cur_sleeper_node->data.until > until)
+			break;
+
+	if (cur_sleeper_node)
+		kthreads_sleeping->insert (
+			(linked_list_kthread_sleeper_t *)kthreads_sleeping, i, sleeper_node);
+	else
+		kthreads_sleeping->append (
+			(linked_list_kthread_sleeper_t *)kthreads_sleeping, sleeper_node);
+
+	kthread_block ();
+
+	// Woken by something other than the clock.
+	if (sleeper_node->data.queued) {
+		kthreads_sleeping->removeNode (
+			(linked_list_kthread_sleeper_t *)kthreads_sleeping, sleeper_node);
+		sleeper_node->data.queued = false;
+	}
+
+	kthread_unlock_task ();
+}
+
+void kthread_sleep_for (time_t duration) {
+	kthread_sleep_until (clock_get_boot_time () + duration);
+}
+
+FAST HOT
+void kthread_wake_sleepers () {
+	linked_list_kthread_sleeper_node_t *sleeper_node;
+
+	if (!kthreads_sleeping->start)
+		return;
+
+	// As clock_get_boot_time, which can't be called from interrupt handlers.
+	const time_t now = CLOCK_INTERVAL * clock_get_ticks ();
+
+	while ((sleeper_node = kthreads_sleeping->start) && now >= sleeper_node->data.until) {
+		kthreads_sleeping->pop ((linked_list_kthread_sleeper_t *)kthreads_sleeping);
+		sleeper_node->data.queued = false;
+
+		kthread_wake (sleeper_node->data.kpid);
+	}
+}
+
 FAST HOT
 bool kthread_lock_task () {
 	// Can in all likely-hood consider a call to lock task the first lock so long as
@@ -548,4 +950,62 @@ kpid_t kthread_get_running_kpid () {
 	return kpid;
 }
 
+bool kthread_set_priority (kpid_t kpid, kthread_priority_t priority) {
+	bool active;
+
+	if (KTHREAD_PRIORITY_MAX < priority)
+		return false;
+
+	kthread_lock_task ();
+
+	volatile linked_list_kthread_node_t *kthread_node = kthread_find (kpid, &active);
+
+	if (kthread_node && active)
+		kthread_deactivate (kthread_node);
+	if (kthread_node)
+		kthread_node->data.priority = priority;
+	if (kthread_node && active)
+		kthread_activate (kthread_node);
+
+	kthread_unlock_task ();
+
+	return NULL != kthread_node;
+}
+
+bool kthread_set_nice (kpid_t kpid, kthread_nice_t nice) {
+	bool active;
+
+	if (KTHREAD_NICE_MIN > nice || KTHREAD_NICE_MAX < nice)
+		return false;
+
+	kthread_lock_task ();
+
+	// The fair tree is ordered by vruntime alone, so it needn't be requeued.
+	volatile linked_list_kthread_node_t *kthread_node = kthread_find (kpid, &active);
+	if (kthread_node)
+		kthread_node->data.nice = nice;
+
+	kthread_unlock_task ();
+
+	return NULL != kthread_node;
+}
+
+clock_t kthread_get_runtime (kpid_t kpid) {
+	bool active;
+	clock_t runtime = 0;
+
+	kthread_lock_task ();
+
+	if (kthread_get_running_kpid () == kpid)
+		kthread_update_runtime ();
+
+	volatile linked_list_kthread_node_t *kthread_node = kthread_find (kpid, &active);
+	if (kthread_node)
+		runtime = kthread_node->data.runtime;
+
+	kthread_unlock_task ();
+
+	return runtime;
+}
+
 // vim: set ts=4 sw=4 noet syn=c:
@@ -1,15 +1,32 @@
 // kernel/sched/mutex.c
 
+#include <stdalign.h>
+
 #include <attributes.h>
 #include <collections/linked_list.h>
 
-#include <mm/malloc.h>
+#include <mm/slab.h>
 #include <kprint/kprint.h>
 #include <kpanic/kpanic.h>
 #include <sched/native_lock.h>
 #include <sched/mutex.h>
 #include <sched/kthread.h>
 
+static kmem_cache_t *mutex_kpid_node_cache;
+
+CONSTRUCTOR
+static void mutex_construct () {
+	mutex_kpid_node_cache = kmem_cache_create (
+		"mutex_kpid",
+		sizeof(mutex_kpid_list_node_t),
+		alignof(mutex_kpid_list_node_t),
+		NULL);
+	if (!mutex_kpid_node_cache) {
+		kputs ("sched/mutex: Failed to create kpid waiting node cache!\n");
+		kpanic ();
+	}
+}
+
 FASTCALL FAST
 void mutex_lock (mutex_t *mutex) {
 	if (!kthread_is_init ())
@@ -22,7 +39,7 @@ void mutex_lock (mutex_t *mutex) {
 	while (!native_lock_try_lock (mutex_get_native_lock (mutex))) {
 		// kpid_node may already be allocated.
 		if (!kpid_node) {
-			kpid_node = malloc (sizeof(mutex_kpid_list_node_t));
+			kpid_node = kmem_cache_alloc (mutex_kpid_node_cache);
 			if (!kpid_node) {
 				kputs ("sched/mutex: Failed to allocate new kpid waiting node!\n");
 				kpanic ();
@@ -41,7 +58,7 @@ void mutex_lock (mutex_t *mutex) {
 			// would get it before threads who have been waiting longer.
 			spinlock_release (mutex_get_spinlock (mutex));
 			mutex_release (mutex);
-			kthread_yield ();
+			kthread_yield_contended ();
 			continue;
 		}
 
@@ -61,7 +78,7 @@ void mutex_lock (mutex_t *mutex) {
 	}
 
 	if (kpid_node)
-		free (kpid_node);
+		kmem_cache_free (mutex_kpid_node_cache, kpid_node);
 }
 
 FASTCALL FAST
@@ -16,7 +16,7 @@ bool spinlock_try_lock (spinlock_t *lock) {
 FASTCALL FAST
 void spinlock_lock (spinlock_t *lock) {
 	while (!spinlock_try_lock (lock))
-		kthread_yield ();
+		kthread_yield_contended ();
 }
 
 FASTCALL FAST
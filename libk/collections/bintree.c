@@ -8,6 +8,106 @@
 // These routines account for a very large quantity of code in this kernel, thus we've
 // added SMALL. 
 
+// The trees are AVL balanced: every insert and remove walks back up from the changed
+// node fixing heights, and rotates wherever the heights of two siblings differ by two.
+
+SMALL
+static size_t bintree_node_height (bintree_node_t *node) {
+	return node ? node->height : 0;
+}
+
+SMALL
+static void bintree_node_update (bintree_t *tree, bintree_node_t *node) {
+	const size_t low_height = bintree_node_height (node->low);
+	const size_t high_height = bintree_node_height (node->high);
+
+	node->height = 1 + (low_height > high_height ? low_height : high_height);
+
+	if (tree->update)
+		tree->update (node);
+}
+
+// Point whatever pointed to node at replacement instead.
+SMALL
+static void bintree_replace_child (
+		bintree_t *tree,
+		bintree_node_t *node,
+		bintree_node_t *replacement
+) {
+	if (node == tree->root)
+		tree->root = replacement;
+	else if (node == node->parent->high)
+		node->parent->high = replacement;
+	else
+		node->parent->low = replacement;
+}
+
+// Lift the low child into the place of node, returning the child.
+SMALL
+static bintree_node_t *bintree_rotate_high (bintree_t *tree, bintree_node_t *node) {
+	bintree_node_t *low = node->low;
+
+	bintree_replace_child (tree, node, low);
+	low->parent = node->parent;
+
+	node->low = low->high;
+	if (node->low)
+		node->low->parent = node;
+
+	low->high = node;
+	node->parent = low;
+
+	bintree_node_update (tree, node);
+	bintree_node_update (tree, low);
+
+	return low;
+}
+
+// Lift the high child into the place of node, returning the child.
+SMALL
+static bintree_node_t *bintree_rotate_low (bintree_t *tree, bintree_node_t *node) {
+	bintree_node_t *high = node->high;
+
+	bintree_replace_child (tree, node, high);
+	high->parent = node->parent;
+
+	node->high = high->low;
+	if (node->high)
+		node->high->parent = node;
+
+	high->low = node;
+	node->parent = high;
+
+	bintree_node_update (tree, node);
+	bintree_node_update (tree, high);
+
+	return high;
+}
+
+SMALL
+static void bintree_rebalance (bintree_t *tree, bintree_node_t *node) {
+	while (node) {
+		const size_t low_height = bintree_node_height (node->low);
+		const size_t high_height = bintree_node_height (node->high);
+
+		if (low_height > high_height + 1) {
+			if (bintree_node_height (node->low->low) <
+					bintree_node_height (node->low->high))
+				bintree_rotate_low (tree, node->low);
+			node = bintree_rotate_high (tree, node);
+		} else if (high_height > low_height + 1) {
+			if (bintree_node_height (node->high->high) <
+					bintree_node_height (node->high->low))
+				bintree_rotate_high (tree, node->high);
+			node = bintree_rotate_low (tree, node);
+		} else {
+			bintree_node_update (tree, node);
+		}
+
+		node = node->parent;
+	}
+}
+
 SMALL
 static bintree_node_t *bintree_node_next (bintree_node_t *node) {
 	bintree_sub_t
@@ -52,12 +152,7 @@ static bintree_node_t *bintree_node_prev (bintree_node_t *node) {
 
 SMALL
 static void bintree_remove_node_zero (bintree_t *tree, bintree_node_t *node) {
-	if (node == tree->root)
-		tree->root = NULL;
-	else if (node == node->parent->high)
-		node->parent->high = NULL;
-	else
-		node->parent->low = NULL;
+	bintree_replace_child (tree, node, NULL);
 
 	node->parent = NULL;
 }
@@ -74,20 +169,16 @@ static void bintree_remove_node_one (bintree_t *tree, bintree_node_t *node) {
 		node->high = NULL;
 	}
 
-	if (node == tree->root)
-		tree->root = replacement;
-	else if (node == node->parent->high)
-		node->parent->high = replacement;
-	else
-		node->parent->low = replacement;
+	bintree_replace_child (tree, node, replacement);
 
 	replacement->parent = node->parent;
 
 	node->parent = NULL;
 }
 
+// Returns the lowest node whose height may have changed.
 SMALL
-static void bintree_remove_node_two (bintree_t *this, bintree_node_t *node) {
+static bintree_node_t *bintree_remove_node_two (bintree_t *this, bintree_node_t *node) {
 	bintree_iterator_t
 		iterator_base,
 		*iterator = &iterator_base;
@@ -102,18 +193,17 @@ static void bintree_remove_node_two (bintree_t *this, bintree_node_t *node) {
 
 	this->last_rm = (this->last_rm + 1) % 2;
 
+	// If the replacement was a child of node, it will take the place of node.
+	bintree_node_t *changed =
+		node == replacement->parent ? replacement : replacement->parent;
+
 	// "replacment" is guerenteed to have zero or one children.
 	if ((!replacement->low) && (!replacement->high))
 		bintree_remove_node_zero (this, replacement);
 	else
 		bintree_remove_node_one (this, replacement);
 
-	if (node == this->root)
-		this->root = replacement;
-	else if (node == node->parent->high)
-		node->parent->high = replacement;
-	else
-		node->parent->low = replacement;
+	bintree_replace_child (this, node, replacement);
 
 	replacement->high = node->high;
 	if (replacement->high)
@@ -122,10 +212,14 @@ static void bintree_remove_node_two (bintree_t *this, bintree_node_t *node) {
 	if (replacement->low)
 		replacement->low->parent = replacement;
 	replacement->parent = node->parent;
+	replacement->height = node->height;
 
 	node->high = NULL;
 	node->low = NULL;
 	node->parent = NULL;
+	node->height = 1;
+
+	return changed;
 }
 
 // The iterator functions are so simple, it's important that they are fast.
@@ -286,6 +380,9 @@ static bintree_node_t *bintree_insert (bintree_t *this, bintree_node_t *node) {
 	if (!parent) {
 		this->root = node;
 		node->parent = NULL;
+		node->low = NULL;
+		node->high = NULL;
+		bintree_node_update (this, node);
 		return NULL;
 	}
 
@@ -298,6 +395,11 @@ static bintree_node_t *bintree_insert (bintree_t *this, bintree_node_t *node) {
 		parent->high = node;
 
 	node->parent = parent;
+	node->low = NULL;
+	node->high = NULL;
+
+	bintree_node_update (this, node);
+	bintree_rebalance (this, parent);
 
 	return NULL;
 }
@@ -307,6 +409,8 @@ static void bintree_remove (bintree_t *this, bintree_node_t *node) {
 		(node->low  ? 1 : 0) +
 		(node->high ? 1 : 0);
 
+	bintree_node_t *changed = node->parent;
+
 	switch (children_count) {
 		case 0:
 			bintree_remove_node_zero (this, node);
@@ -315,9 +419,13 @@ static void bintree_remove (bintree_t *this, bintree_node_t *node) {
 			bintree_remove_node_one (this, node);
 			break;
 		case 2:
-			bintree_remove_node_two (this, node);
+			changed = bintree_remove_node_two (this, node);
 			break;
 	}
+
+	node->height = 1;
+
+	bintree_rebalance (this, changed);
 }
 
 static bintree_iterator_t new_bintree_iterator_from_tree (bintree_t *this) {
@@ -344,6 +452,7 @@ bintree_t new_bintree () {
 		.remove = bintree_remove,
 		.get_fields = bintree_get_fields,
 		.new_iterator = new_bintree_iterator_from_tree,
+		.update = NULL
 	};
 
 	return tree;
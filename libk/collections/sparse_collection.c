@@ -4,26 +4,32 @@
 #include <stdbool.h>
 #include <limits.h>
 
-#include <strings.h>
 #include <string.h>
 #include <collections/sparse_collection.h>
 
+#define SPARSE_COLLECTION_INT_BITS (8 * sizeof(int))
+
 static int *sparse_collection_get_bit_int (size_t i, int *bitmap) {
-	return bitmap + (i - 1) / (8 * sizeof(int));
+	return bitmap + i / SPARSE_COLLECTION_INT_BITS;
 }
 
 static void sparse_collection_set_bit (size_t i, int *bitmap) {
-	*sparse_collection_get_bit_int (i, bitmap) |= 1U << ((i - 1) % (8 * sizeof(int)));
+	*sparse_collection_get_bit_int (i, bitmap) |= 1U << (i % SPARSE_COLLECTION_INT_BITS);
 }
 
 static void sparse_collection_unset_bit (size_t i, int *bitmap) {
-	*sparse_collection_get_bit_int (i, bitmap) &= ~(1U << ((i - 1) % (8 * sizeof(int))));
+	*sparse_collection_get_bit_int (i, bitmap) &= ~(1U << (i % SPARSE_COLLECTION_INT_BITS));
+}
+
+// Index of the lowest set bit, which must exist.  Compiles to a single bsf.
+static size_t sparse_collection_scan (int bits) {
+	return __builtin_ctz ((unsigned int)bits);
 }
 
 // Get bitmap length as a number of integers.
 static size_t sparse_collection_get_bitmap_length (size_t elm_size, size_t length) {
 	// Number of bytes of elements one int can hold.
-	const size_t elmbytes_p_int = elm_size * 8 * sizeof(int);
+	const size_t elmbytes_p_int = elm_size * SPARSE_COLLECTION_INT_BITS;
 	// Number of bytes that can be mapped by one int (including itself).
 	const size_t bytes_p_int = elmbytes_p_int + sizeof(int);
 
@@ -40,9 +46,15 @@ static size_t sparse_collection_get_bitmap_length (size_t elm_size, size_t lengt
 	return full_ints + 1;
 }
 
-// Get element array length as a number of integers.
+// Get summary length as a number of integers.
+static size_t sparse_collection_get_summary_length (size_t bitmap_length) {
+	return (bitmap_length + SPARSE_COLLECTION_INT_BITS - 1) / SPARSE_COLLECTION_INT_BITS;
+}
+
+// Get element array length as a number of elements.
 static size_t sparse_collection_get_elm_arr_length (
 		size_t bitmap_length,
+		size_t summary_length,
 		size_t elm_size,
 		size_t length
 ) {
@@ -51,11 +63,19 @@ static size_t sparse_collection_get_elm_arr_length (
 	if (0 == bitmap_length)
 		return 0;
 
+	const size_t map_bytes = sizeof(int) * (bitmap_length + summary_length);
+	if (length < map_bytes)
+		return 0;
+
 	// The number of bytes allocatable to elements.
-	const size_t allocatable_bytes = length - sizeof(int) * bitmap_length;
+	const size_t allocatable_bytes = length - map_bytes;
+	const size_t elm_arr_length = allocatable_bytes / elm_size;
 
-	// Number of full elements that can be allocated.
-	return allocatable_bytes / elm_size;
+	// The summary may have taken the room of the last few elements.
+	if (SPARSE_COLLECTION_INT_BITS * bitmap_length < elm_arr_length)
+		return SPARSE_COLLECTION_INT_BITS * bitmap_length;
+
+	return elm_arr_length;
 }
 
 // Get bitmap pointer.
@@ -63,46 +83,67 @@ static int *sparse_collection_get_bitmap (size_t bitmap_length, void *data, size
 	return (int *)(data + length - sizeof(int) * bitmap_length);
 }
 
+// Get summary pointer, directly below the bitmap.
+static int *sparse_collection_get_summary (size_t summary_length, int *bitmap) {
+	return bitmap - summary_length;
+}
+
 // Get element array pointer.
 static void *sparse_collection_get_elm_arr (void *data) {
 	return data;
 }
 
-// Initialize the bitmap
-static void sparse_collection_init_bitmap (int *bitmap, size_t elm_arr_length) {
-	while (8 * sizeof(int) <= elm_arr_length) {
-		*bitmap++ = UINT_MAX;
+// Initialize the bitmap and its summary.
+static void sparse_collection_init_bitmap (sparse_collection_t *this) {
+	size_t i, remaining = this->elm_arr_length;
 
-		elm_arr_length -= 8 * sizeof(int);
-	}
+	for (i = 0; this->summary_length > i; ++i)
+		this->summary[i] = 0;
+
+	for (i = 0; this->bitmap_length > i; ++i) {
+		if (SPARSE_COLLECTION_INT_BITS <= remaining) {
+			this->bitmap[i] = UINT_MAX;
+			remaining -= SPARSE_COLLECTION_INT_BITS;
+		} else {
+			this->bitmap[i] = (1U << remaining) - 1;
+			remaining = 0;
+		}
 
-	if (elm_arr_length)
-		*bitmap = (1 << elm_arr_length) - 1;
+		if (this->bitmap[i])
+			sparse_collection_set_bit (i, this->summary);
+	}
 
-	return;
+	this->hint = 0;
+	while (this->summary_length > this->hint && !this->summary[this->hint])
+		this->hint += 1;
 }
 
 // Return index of next set bit (starting at 1), zero if no bit is set.
 static size_t sparse_collection_get (const sparse_collection_t *this) {
-	size_t i;
-	int submap = 0;
-
-	for (i = 0; this->bitmap_length > i; ++i) {
-		if (0 != this->bitmap[i]) {
-			submap = this->bitmap[i];
-			break;
-		}
-	}
-
-	if (!submap)
+	if (this->summary_length == this->hint)
 		return 0;
 
-	return ffs (submap) + 8 * i * sizeof(int);
+	const size_t i =
+		SPARSE_COLLECTION_INT_BITS * this->hint +
+		sparse_collection_scan (this->summary[this->hint]);
+
+	return
+		SPARSE_COLLECTION_INT_BITS * i +
+		sparse_collection_scan (this->bitmap[i]) + 1;
 }
 
 // Allocated index (starting at 1).
 static void *sparse_collection_alloc (sparse_collection_t *this, size_t i) {
-	sparse_collection_unset_bit (i, this->bitmap);
+	sparse_collection_unset_bit (i - 1, this->bitmap);
+
+	const size_t bit_int = (i - 1) / SPARSE_COLLECTION_INT_BITS;
+
+	if (!this->bitmap[bit_int]) {
+		sparse_collection_unset_bit (bit_int, this->summary);
+
+		while (this->summary_length > this->hint && !this->summary[this->hint])
+			this->hint += 1;
+	}
 
 	return this->elm_arr + this->elm_size * (i - 1);
 }
@@ -120,9 +161,15 @@ static bool sparse_collection_insert (sparse_collection_t *this, const void *elm
 }
 
 static void sparse_collection_free (sparse_collection_t *this, const void *elm) {
-	const size_t i = (elm - this->elm_arr) / this->elm_size + 1;
+	const size_t i = (elm - this->elm_arr) / this->elm_size;
+	const size_t bit_int = i / SPARSE_COLLECTION_INT_BITS;
+	const size_t summary_int = bit_int / SPARSE_COLLECTION_INT_BITS;
 
 	sparse_collection_set_bit (i, this->bitmap);
+	sparse_collection_set_bit (bit_int, this->summary);
+
+	if (this->hint > summary_int)
+		this->hint = summary_int;
 }
 
 sparse_collection_t new_sparse_collection (
@@ -132,13 +179,21 @@ sparse_collection_t new_sparse_collection (
 ) {
 	const size_t bitmap_length =
 		sparse_collection_get_bitmap_length (elm_size, length);
-	const size_t elm_arr_length =
-		sparse_collection_get_elm_arr_length (bitmap_length, elm_size, length);
+	const size_t summary_length =
+		sparse_collection_get_summary_length (bitmap_length);
+	const size_t elm_arr_length = sparse_collection_get_elm_arr_length (
+		bitmap_length, summary_length, elm_size, length);
+	int *const bitmap =
+		sparse_collection_get_bitmap (bitmap_length, data, length);
 
 	sparse_collection_t collection = {
-		.bitmap = sparse_collection_get_bitmap (bitmap_length, data, length),
+		.bitmap = bitmap,
 		.bitmap_length = bitmap_length,
+		.summary = sparse_collection_get_summary (summary_length, bitmap),
+		.summary_length = summary_length,
+		.hint = 0,
 		.elm_arr = sparse_collection_get_elm_arr (data),
+		.elm_arr_length = elm_arr_length,
 		.elm_size = elm_size,
 		.get = sparse_collection_get,
 		.alloc = sparse_collection_alloc,
@@ -146,7 +201,7 @@ sparse_collection_t new_sparse_collection (
 		.free = sparse_collection_free
 	};
 
-	sparse_collection_init_bitmap (collection.bitmap, elm_arr_length);
+	sparse_collection_init_bitmap (&collection);
 
 	return collection;
 }
@@ -15,6 +15,8 @@ typedef struct bintree_node_struct {
 	bintree_node_t *low;
 	bintree_node_t *high;
 	bintree_node_t *parent;
+	// Height of the subtree rooted here, a lone node is one high.
+	size_t height;
 	size_t orderby;
 	bintree_zero_width_t data;
 } bintree_node_t;
@@ -53,6 +55,10 @@ typedef struct bintree_struct {
 	void (*remove) (bintree_t *, bintree_node_t *);
 	bintree_fields_t (*get_fields) (bintree_t *);
 	bintree_iterator_t (*new_iterator) (bintree_t *);
+	// Optional, called on every node whose subtree has changed, children first.  This
+	// allows nodes to carry information about their whole subtree.  Trees created from
+	// fields never have one.
+	void (*update) (bintree_node_t *);
 } bintree_t;
 
 static inline bintree_node_t new_bintree_node (size_t orderby) {
@@ -60,6 +66,7 @@ static inline bintree_node_t new_bintree_node (size_t orderby) {
 		.low = NULL,
 		.high = NULL,
 		.parent = NULL,
+		.height = 1,
 		.orderby = orderby
 	};
 
@@ -86,6 +93,7 @@ typedef struct bintree_##name##_node_struct { \
 	bintree_##name##_node_t *low; \
 	bintree_##name##_node_t *high; \
 	bintree_##name##_node_t *parent; \
+	size_t height; \
 	size_t orderby; \
 	type data; \
 } bintree_##name##_node_t; \
@@ -98,6 +106,7 @@ static inline bintree_##name##_node_t new_bintree_##name##_node ( \
 		.low = NULL, \
 		.high = NULL, \
 		.parent = NULL, \
+		.height = 1, \
 		.orderby = orderby, \
 		.data = data \
 	}; \
@@ -160,6 +169,7 @@ typedef struct bintree_##name##_struct { \
 	void (*remove) (bintree_##name##_t *, bintree_##name##_node_t *); \
 	bintree_##name##_fields_t (*get_fields) (bintree_##name##_t *); \
 	bintree_##name##_iterator_t (*new_iterator) (bintree_##name##_t *); \
+	void (*update) (bintree_##name##_node_t *); \
 } MAY_ALIAS bintree_##name##_t; \
 \
 static inline bintree_##name##_t new_bintree_##name () { \
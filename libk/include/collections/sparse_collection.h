@@ -8,11 +8,19 @@
 
 #include <attributes.h>
 
+// A set bit in the bitmap marks a free element, and a set bit in the summary marks an
+// int of the bitmap with any bit set.  Every summary int before the hint is zero, so
+// finding a free element is two bit scans.
+
 typedef struct sparse_collection_struct sparse_collection_t;
 typedef struct sparse_collection_struct {
 	int *bitmap;
 	size_t bitmap_length; // Length of bitmap in sizeof(int).
+	int *summary;
+	size_t summary_length; // Length of summary in sizeof(int).
+	size_t hint; // Index of the first non-zero int of the summary.
 	void *elm_arr;
+	size_t elm_arr_length; // Number of elements.
 	size_t elm_size; // Size of element.
 	size_t (*get) (const sparse_collection_t *);
 	void *(*alloc) (sparse_collection_t *, size_t);
@@ -27,7 +35,11 @@ typedef struct sparse_collection_##name##_struct sparse_collection_##name##_t; \
 typedef struct sparse_collection_##name##_struct { \
 	int *bitmap; \
 	size_t bitmap_length; \
+	int *summary; \
+	size_t summary_length; \
+	size_t hint; \
 	type *elm_arr; \
+	size_t elm_arr_length; \
 	size_t elm_size; \
 	size_t (*get) (const sparse_collection_##name##_t *); \
 	void *(*alloc) (sparse_collection_##name##_t *, size_t); \
@@ -6,10 +6,11 @@
 #include <stddef.h>
 #include <strings.h>
 
-const void *memchr (const void *, int, size_t);
+void *memchr (const void *, int, size_t);
 
 void *memcpy (void *restrict, const void *, size_t);
 void *memccpy (void *restrict, const void *, int, size_t);
+void *memmove (void *, const void *, size_t);
 
 void *memset (void *s, int c, size_t n);
 
@@ -2,13 +2,13 @@
 
 #include <stddef.h>
 
-const void *memchr (const void *s, int c, size_t n) {
+void *memchr (const void *s, int c, size_t n) {
 	const unsigned char *s_u8_ptr = s;
 	unsigned char c_u8 = c;
 
 	while (n--) {
 		if (c_u8 == *s_u8_ptr)
-			return s_u8_ptr;
+			return (void *)s_u8_ptr;
 
 		++s_u8_ptr;
 	}
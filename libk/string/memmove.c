@@ -0,0 +1,41 @@
+// libk/string/memmove.c
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Copying forwards is only safe when the destination is below the source, and
+// backwards when it is above.
+#define MKMEMMOVE(name, type) \
+static inline void __##name##_memmove (type *dest, const type *src, size_t n) { \
+	if (dest < src) { \
+		while (n--) \
+			*dest++ = *src++; \
+	} else { \
+		dest += n; \
+		src += n; \
+\
+		while (n--) \
+			*--dest = *--src; \
+	} \
+}
+
+MKMEMMOVE(byte, uint8_t);
+MKMEMMOVE(word, uint16_t);
+
+void *memmove (void *dest, const void *src, size_t n) {
+#pragma GCC diagnostic ignored "-Wpointer-to-int-cast"
+	size_t src_as_num = (size_t)src, dest_as_num = (size_t)dest;
+#pragma GCC diagnostic pop
+
+	if (dest == src)
+		return dest;
+
+	if (0b1 & (src_as_num | dest_as_num | n))
+		__byte_memmove ((uint8_t *)dest, (const uint8_t *)src, n);
+	else
+		__word_memmove ((uint16_t *)dest, (const uint16_t *)src, n >> 1);
+
+	return dest;
+}
+
+// vim: set ts=4 sw=4 noet syn=c:
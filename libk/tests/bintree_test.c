@@ -0,0 +1,174 @@
+// libk/tests/bintree_test.c
+
+// Built for the host by "make test".  Checks that the AVL balancing keeps trees
+// O(log n) high under the insertion patterns the kernel uses, and that update keeps
+// per-subtree data correct through rotations, which freemem depends on.
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <collections/bintree.h>
+
+#define BINTREE_TEST_NODES 4096
+#define BINTREE_TEST_ROUNDS 4
+
+// As freemem's regions, each node carries the longest length in its subtree.
+typedef struct bintree_test_data_struct {
+	size_t length;
+	size_t max_length;
+} bintree_test_data_t;
+
+TPL_BINTREE (test, bintree_test_data_t)
+
+static bintree_test_node_t bintree_test_nodes[BINTREE_TEST_NODES];
+static bool bintree_test_inserted[BINTREE_TEST_NODES];
+
+static void bintree_test_fail (const char *msg) {
+	fprintf (stderr, "libk/tests/bintree_test: %s!\n", msg);
+	exit (EXIT_FAILURE);
+}
+
+static void bintree_test_update (bintree_test_node_t *node) {
+	size_t max_length = node->data.length;
+
+	if (node->low && node->low->data.max_length > max_length)
+		max_length = node->low->data.max_length;
+	if (node->high && node->high->data.max_length > max_length)
+		max_length = node->high->data.max_length;
+
+	node->data.max_length = max_length;
+}
+
+// Check every link, height, balance factor and max_length below node, returning its
+// height.
+static size_t bintree_test_check_node (
+		bintree_test_node_t *node,
+		bintree_test_node_t *parent,
+		size_t *count
+) {
+	if (!node)
+		return 0;
+
+	if (node->parent != parent)
+		bintree_test_fail ("Wrong parent");
+	if (node->low && node->low->orderby >= node->orderby)
+		bintree_test_fail ("Low child out of order");
+	if (node->high && node->high->orderby <= node->orderby)
+		bintree_test_fail ("High child out of order");
+
+	const size_t low_height = bintree_test_check_node (node->low, node, count);
+	const size_t high_height = bintree_test_check_node (node->high, node, count);
+
+	if (low_height > high_height + 1 || high_height > low_height + 1)
+		bintree_test_fail ("Unbalanced node");
+
+	const size_t height = 1 + (low_height > high_height ? low_height : high_height);
+	if (node->height != height)
+		bintree_test_fail ("Wrong height");
+
+	size_t max_length = node->data.length;
+	if (node->low && node->low->data.max_length > max_length)
+		max_length = node->low->data.max_length;
+	if (node->high && node->high->data.max_length > max_length)
+		max_length = node->high->data.max_length;
+	if (node->data.max_length != max_length)
+		bintree_test_fail ("Stale max_length");
+
+	*count += 1;
+
+	return height;
+}
+
+static size_t bintree_test_check (bintree_test_t *tree, size_t expected_count) {
+	size_t count = 0;
+	const size_t height = bintree_test_check_node (tree->root, NULL, &count);
+
+	if (count != expected_count)
+		bintree_test_fail ("Wrong node count");
+
+	if ((double)height > 1.44 * log2 ((double)count + 2))
+		bintree_test_fail ("Tree is too high");
+
+	return height;
+}
+
+static void bintree_test_insert (bintree_test_t *tree, size_t i, size_t orderby) {
+	const bintree_test_data_t data = {
+		.length = (size_t)rand () % 0x10000,
+		.max_length = 0
+	};
+
+	bintree_test_nodes[i] = new_bintree_test_node (data, orderby);
+	if (tree->insert (tree, &bintree_test_nodes[i]))
+		bintree_test_fail ("Unexpected conflict");
+
+	bintree_test_inserted[i] = true;
+}
+
+static void bintree_test_remove (bintree_test_t *tree, size_t i) {
+	tree->remove (tree, &bintree_test_nodes[i]);
+
+	bintree_test_inserted[i] = false;
+}
+
+// Ascending inserts are the worst case for an unbalanced tree and the common one here,
+// kpids, e820 entries and devices all arrive in order.  The stride stands in for
+// addresses.
+static void bintree_test_ascending (size_t stride) {
+	bintree_test_t tree_base = new_bintree_test (), *tree = &tree_base;
+	size_t i, live = 0, height = 0;
+
+	tree->update = bintree_test_update;
+
+	for (i = 0; BINTREE_TEST_NODES > i; ++i) {
+		bintree_test_insert (tree, i, stride * (i + 1));
+		height = bintree_test_check (tree, ++live);
+	}
+
+	printf ("ascending, stride %zu: %zu nodes, height %zu\n", stride, live, height);
+
+	// Random removes, with some of them put back in between.
+	for (i = 0; BINTREE_TEST_ROUNDS * BINTREE_TEST_NODES > i; ++i) {
+		const size_t node = (size_t)rand () % BINTREE_TEST_NODES;
+
+		if (bintree_test_inserted[node]) {
+			bintree_test_remove (tree, node);
+			--live;
+		} else if (rand () % 2) {
+			bintree_test_insert (tree, node, stride * (node + 1));
+			++live;
+		}
+
+		height = bintree_test_check (tree, live);
+	}
+
+	printf ("after random removes: %zu nodes, height %zu\n", live, height);
+
+	// Drain what is left in ascending order.
+	for (i = 0; BINTREE_TEST_NODES > i; ++i) {
+		if (!bintree_test_inserted[i])
+			continue;
+
+		bintree_test_remove (tree, i);
+		bintree_test_check (tree, --live);
+	}
+
+	if (tree->root)
+		bintree_test_fail ("Tree not empty after removing every node");
+}
+
+int main () {
+	srand (1);
+
+	bintree_test_ascending (1);
+	bintree_test_ascending (0x1000);
+
+	puts ("libk/tests/bintree_test: Passed.");
+
+	return EXIT_SUCCESS;
+}
+
+// vim: set ts=4 sw=4 noet syn=c:
@@ -0,0 +1,119 @@
+// libk/tests/sparse_collection_bench.c
+
+// Built for the host by "make test".  Times filling and draining a large collection,
+// checking on the way that get hands out every free slot exactly once and returns zero
+// once the collection is full.
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <collections/sparse_collection.h>
+
+#define SPARSE_COLLECTION_BENCH_LENGTH (4 * 1024 * 1024)
+#define SPARSE_COLLECTION_BENCH_ELM_SIZE 16
+#define SPARSE_COLLECTION_BENCH_ROUNDS 3
+
+static void sparse_collection_bench_fail (const char *msg) {
+	fprintf (stderr, "libk/tests/sparse_collection_bench: %s!\n", msg);
+	exit (EXIT_FAILURE);
+}
+
+// Take every free slot, each of which must not already be taken.
+static void sparse_collection_bench_fill (sparse_collection_t *collection, bool *taken) {
+	size_t i, count = 0;
+
+	while ((i = collection->get (collection))) {
+		if (collection->elm_arr_length < i)
+			sparse_collection_bench_fail ("Index out of range");
+		if (taken[i - 1])
+			sparse_collection_bench_fail ("Slot handed out twice");
+
+		taken[i - 1] = true;
+		collection->alloc (collection, i);
+		++count;
+	}
+
+	if (collection->elm_arr_length != count)
+		sparse_collection_bench_fail ("Not every slot was handed out");
+
+	const char elm[SPARSE_COLLECTION_BENCH_ELM_SIZE] = { 0 };
+	if (collection->insert (collection, elm))
+		sparse_collection_bench_fail ("Insert succeeded on a full collection");
+}
+
+// Free every slot, in the order given.
+static void sparse_collection_bench_drain (
+		sparse_collection_t *collection,
+		bool *taken,
+		const size_t *order
+) {
+	size_t i;
+
+	for (i = 0; collection->elm_arr_length > i; ++i) {
+		const size_t slot = order[i];
+
+		collection->free (
+			collection,
+			(char *)collection->elm_arr + collection->elm_size * slot);
+		taken[slot] = false;
+	}
+}
+
+int main () {
+	void *const data = malloc (SPARSE_COLLECTION_BENCH_LENGTH);
+	sparse_collection_t collection_base, *collection = &collection_base;
+	size_t i, round;
+
+	if (!data)
+		sparse_collection_bench_fail ("Out of memory");
+
+	collection_base = new_sparse_collection (
+		data, SPARSE_COLLECTION_BENCH_LENGTH, SPARSE_COLLECTION_BENCH_ELM_SIZE);
+
+	const size_t length = collection->elm_arr_length;
+	bool *const taken = calloc (length, sizeof(bool));
+	size_t *const order = malloc (length * sizeof(size_t));
+	if (!taken || !order)
+		sparse_collection_bench_fail ("Out of memory");
+
+	srand (1);
+
+	for (round = 0; SPARSE_COLLECTION_BENCH_ROUNDS > round; ++round) {
+		// Drain in ascending, descending then shuffled order, the hint must cope with
+		// each.
+		for (i = 0; length > i; ++i)
+			order[i] = 1 == round ? length - 1 - i : i;
+
+		if (2 == round) {
+			for (i = length - 1; 0 < i; --i) {
+				const size_t j = (size_t)rand () % (i + 1);
+				const size_t tmp = order[i];
+
+				order[i] = order[j];
+				order[j] = tmp;
+			}
+		}
+
+		const clock_t start = clock ();
+
+		sparse_collection_bench_fill (collection, taken);
+		sparse_collection_bench_drain (collection, taken, order);
+
+		printf (
+			"round %zu: filled and drained %zu slots in %.3fs\n",
+			round, length, (double)(clock () - start) / CLOCKS_PER_SEC);
+	}
+
+	puts ("libk/tests/sparse_collection_bench: Passed.");
+
+	free (order);
+	free (taken);
+	free (data);
+
+	return EXIT_SUCCESS;
+}
+
+// vim: set ts=4 sw=4 noet syn=c: